@@ -0,0 +1,574 @@
+/*++
+
+Module Name:
+
+	fsa4480bench.c
+
+Abstract:
+
+	Drives the FSA4480 chip logic through every switch mode and USB-C
+	partner transition against the simulated register file and reports
+	the I2C cost of each transition.
+
+	Every row starts from a freshly initialized chip, applies the "from"
+	action and then measures the "to" action. After every action the
+	driver's register cache must agree with the simulated registers and
+	the published state snapshot with the chip state, the program exits
+	with 1 if they do not or if an action fails.
+
+	The table is for batched transition programs, one Spb sequence each,
+	as the driver issues them. The whole matrix also runs with one
+	transaction per register access and both are summarized at the end,
+	followed by the cost of repeated MIC/GND swaps.
+
+Environment:
+
+	Host (Linux, user mode)
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsa4480sim.h"
+
+typedef enum _BENCH_ACTION_TYPE
+{
+	BenchActionSwitch,
+	BenchActionPartner,
+	BenchActionPowerCycle
+} BENCH_ACTION_TYPE;
+
+typedef struct _BENCH_ACTION
+{
+	const char *Name;
+	BENCH_ACTION_TYPE Type;
+	ULONG Value;
+} BENCH_ACTION;
+
+static const BENCH_ACTION gActions[] =
+	{
+		{"swap-mic-gnd", BenchActionSwitch, FSA4480_SWAP_MIC_GND},
+		{"usbc-cc1", BenchActionSwitch, FSA4480_SET_USBC_CC1},
+		{"usbc-cc2", BenchActionSwitch, FSA4480_SET_USBC_CC2},
+		{"dp-disconnected", BenchActionSwitch, FSA4480_SET_DP_DISCONNECTED},
+		{"partner-invalid", BenchActionPartner, UsbCPartnerInvalid},
+		{"partner-ufp", BenchActionPartner, UsbCPartnerUfp},
+		{"partner-dfp", BenchActionPartner, UsbCPartnerDfp},
+		{"partner-cable", BenchActionPartner, UsbCPartnerPoweredCableNoUfp},
+		{"partner-cable-ufp", BenchActionPartner, UsbCPartnerPoweredCableWithUfp},
+		{"partner-audio", BenchActionPartner, UsbCPartnerAudioAccessory},
+		{"partner-debug", BenchActionPartner, UsbCPartnerDebugAccessory},
+		{"power-cycle", BenchActionPowerCycle, 0},
+};
+
+static const BENCH_ACTION gInitialModes[] =
+	{
+		{"init-disconnected", BenchActionSwitch, FSA4480_SET_DP_DISCONNECTED},
+		{"init-cc1", BenchActionSwitch, FSA4480_SET_USBC_CC1},
+		{"init-cc2", BenchActionSwitch, FSA4480_SET_USBC_CC2},
+};
+
+typedef struct _BENCH
+{
+	SIM_CHIP Sim;
+	FSA4480_CHIP Chip;
+} BENCH;
+
+static int gFailures;
+
+static VOID
+BenchCheckCache(
+	BENCH *Bench,
+	const char *Step)
+{
+	ULONG address;
+
+	for (address = 0; address < FSA4480_REGISTER_COUNT; address++)
+	{
+		if ((Bench->Chip.RegisterCache.ValidMask & (1UL << address)) == 0)
+		{
+			continue;
+		}
+
+		if (Bench->Chip.RegisterCache.Values[address] != Bench->Sim.Registers[address])
+		{
+			fprintf(stderr,
+					"%s: register 0x%02x cached as 0x%02x, chip holds 0x%02x\n",
+					Step,
+					address,
+					Bench->Chip.RegisterCache.Values[address],
+					Bench->Sim.Registers[address]);
+			gFailures++;
+		}
+	}
+}
+
+static VOID
+BenchCheckState(
+	BENCH *Bench,
+	const char *Step)
+{
+	FSA4480_STATE_SNAPSHOT snapshot;
+
+	FSA4480_ReadState(&Bench->Chip, &snapshot);
+
+	if (snapshot.State != (ULONG)Bench->Chip.State ||
+		snapshot.Partner != (ULONG)Bench->Chip.USBCPartner ||
+		snapshot.RegisterValidMask != Bench->Chip.RegisterCache.ValidMask ||
+		memcmp(snapshot.Registers, Bench->Chip.RegisterCache.Values, sizeof(snapshot.Registers)) != 0)
+	{
+		fprintf(stderr,
+				"%s: published state %u (generation %u) does not match chip state %u\n",
+				Step,
+				snapshot.State,
+				snapshot.Generation,
+				(unsigned)Bench->Chip.State);
+		gFailures++;
+	}
+}
+
+static VOID
+BenchApply(
+	BENCH *Bench,
+	const BENCH_ACTION *Action)
+{
+	NTSTATUS status;
+
+	if (Action->Type == BenchActionSwitch)
+	{
+		FSA4480_BeginSwitchTiming(
+			&Bench->Chip,
+			FSA4480_LATENCY_SOURCE_COUNT,
+			Bench->Chip.Bus.QueryTime(Bench->Chip.Bus.Context));
+		status = FSA4480_Switch(&Bench->Chip, (FSA4480_SWITCH_MODE)Action->Value);
+	}
+	else if (Action->Type == BenchActionPartner)
+	{
+		status = FSA4480_OnUSBCModeChanged(&Bench->Chip, (USBC_PARTNER)Action->Value);
+	}
+	else
+	{
+		//
+		// EN released and asserted again, the chip comes back with its
+		// reset values
+		//
+		FSA4480_PowerDown(&Bench->Chip);
+		SimChipReset(&Bench->Sim);
+		status = FSA4480_PowerUp(&Bench->Chip);
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		fprintf(stderr, "%s failed: 0x%08x\n", Action->Name, (unsigned)status);
+		gFailures++;
+	}
+
+	BenchCheckCache(Bench, Action->Name);
+	BenchCheckState(Bench, Action->Name);
+}
+
+static VOID
+BenchReset(
+	BENCH *Bench,
+	FSA4480_SWITCH_MODE InitialMode,
+	BOOLEAN Batched)
+{
+	NTSTATUS status;
+
+	memset(Bench, 0, sizeof(*Bench));
+	SimChipInitialize(&Bench->Sim);
+	SimChipBindBus(&Bench->Sim, &Bench->Chip.Bus, Batched);
+	FSA4480_InitializeProfiles(&Bench->Chip.ProfileTable);
+
+	status = FSA4480_Initialize(&Bench->Chip, InitialMode);
+	if (!NT_SUCCESS(status))
+	{
+		fprintf(stderr, "FSA4480_Initialize failed: 0x%08x\n", (unsigned)status);
+		gFailures++;
+	}
+
+	BenchCheckCache(Bench, "initialize");
+	BenchCheckState(Bench, "initialize");
+}
+
+static VOID
+BenchPrintRow(
+	const char *From,
+	const char *To,
+	const SIM_STATISTICS *Before,
+	const SIM_STATISTICS *After)
+{
+	printf("%-18s %-18s %6u %6u %6u %10.1f %10.1f %6u\n",
+		   From,
+		   To,
+		   After->Transactions - Before->Transactions,
+		   After->BytesWritten - Before->BytesWritten,
+		   After->BytesRead - Before->BytesRead,
+		   (After->BusTimeNs - Before->BusTimeNs) / 1000.0,
+		   (After->BusTimeNs - Before->BusTimeNs + After->DelayTimeNs - Before->DelayTimeNs) / 1000.0,
+		   After->LiveControlWrites - Before->LiveControlWrites);
+}
+
+static ULONG
+BenchRunMatrix(
+	BENCH *Bench,
+	BOOLEAN Batched,
+	BOOLEAN Print,
+	SIM_STATISTICS *Totals)
+{
+	SIM_STATISTICS before;
+	ULONG from, to;
+	ULONG rows = 0;
+
+	memset(Totals, 0, sizeof(*Totals));
+
+	//
+	// Initialization on its own, into each orientation CC_OUT can report
+	//
+	for (to = 0; to < ARRAYSIZE(gInitialModes); to++)
+	{
+		BenchReset(Bench, (FSA4480_SWITCH_MODE)gInitialModes[to].Value, Batched);
+		memset(&before, 0, sizeof(before));
+
+		if (Print)
+		{
+			BenchPrintRow("reset", gInitialModes[to].Name, &before, &Bench->Sim.Statistics);
+		}
+	}
+
+	for (from = 0; from < ARRAYSIZE(gActions); from++)
+	{
+		for (to = 0; to < ARRAYSIZE(gActions); to++)
+		{
+			BenchReset(Bench, FSA4480_SET_DP_DISCONNECTED, Batched);
+			BenchApply(Bench, &gActions[from]);
+
+			before = Bench->Sim.Statistics;
+			BenchApply(Bench, &gActions[to]);
+
+			if (Print)
+			{
+				BenchPrintRow(gActions[from].Name, gActions[to].Name, &before, &Bench->Sim.Statistics);
+			}
+
+			Totals->Transactions += Bench->Sim.Statistics.Transactions - before.Transactions;
+			Totals->BytesWritten += Bench->Sim.Statistics.BytesWritten - before.BytesWritten;
+			Totals->BytesRead += Bench->Sim.Statistics.BytesRead - before.BytesRead;
+			Totals->BusTimeNs += Bench->Sim.Statistics.BusTimeNs - before.BusTimeNs;
+			Totals->DelayTimeNs += Bench->Sim.Statistics.DelayTimeNs - before.DelayTimeNs;
+			Totals->LiveControlWrites += Bench->Sim.Statistics.LiveControlWrites - before.LiveControlWrites;
+			rows++;
+		}
+	}
+
+	return rows;
+}
+
+static VOID
+BenchPrintTotals(
+	const char *Name,
+	ULONG Rows,
+	const SIM_STATISTICS *Totals)
+{
+	printf("%-10s %u transitions: %u transactions, %u bytes written, %u bytes read, "
+		   "%.1f us on the bus, %.1f us total (%.1f us per transition), "
+		   "%u live SWITCH_CONTROL writes\n",
+		   Name,
+		   Rows,
+		   Totals->Transactions,
+		   Totals->BytesWritten,
+		   Totals->BytesRead,
+		   Totals->BusTimeNs / 1000.0,
+		   (Totals->BusTimeNs + Totals->DelayTimeNs) / 1000.0,
+		   (Totals->BusTimeNs + Totals->DelayTimeNs) / 1000.0 / Rows,
+		   Totals->LiveControlWrites);
+}
+
+//
+// Headset detection probes both MIC/GND polarities, toggle the swap on an
+// attached audio accessory and report the cost of each toggle and the
+// latency the driver recorded for it
+//
+#define BENCH_SWAP_TOGGLES 16
+
+static VOID
+BenchRunSwapToggles(
+	BENCH *Bench,
+	const char *Name,
+	BOOLEAN Batched)
+{
+	static const BENCH_ACTION partnerAudio = {"partner-audio", BenchActionPartner, UsbCPartnerAudioAccessory};
+	static const BENCH_ACTION swapMicGnd = {"swap-mic-gnd", BenchActionSwitch, FSA4480_SWAP_MIC_GND};
+	PFSA4480_LATENCY_HISTOGRAM histogram;
+	SIM_STATISTICS before;
+	SIM_STATISTICS *after;
+	ULONG i;
+
+	BenchReset(Bench, FSA4480_SET_DP_DISCONNECTED, Batched);
+	BenchApply(Bench, &partnerAudio);
+
+	before = Bench->Sim.Statistics;
+
+	for (i = 0; i < BENCH_SWAP_TOGGLES; i++)
+	{
+		BenchApply(Bench, &swapMicGnd);
+	}
+
+	after = &Bench->Sim.Statistics;
+	histogram = &Bench->Chip.SwitchLatency.Histograms[FSA4480_LATENCY_MODE_MIC_GND_SWAP][FSA4480_LATENCY_STAGE_COMPLETE];
+
+	if (histogram->Count != BENCH_SWAP_TOGGLES)
+	{
+		fprintf(stderr, "%u MIC/GND swap latencies recorded for %u toggles\n", histogram->Count, BENCH_SWAP_TOGGLES);
+		gFailures++;
+	}
+
+	//
+	// A batched settle delay is only seen as part of its transaction
+	//
+	if (Bench->Chip.SettleDelay.LastRequestedUs != FSA4480_SWITCH_SETTLE_US ||
+		Bench->Chip.SettleDelay.LastBatched != Batched)
+	{
+		fprintf(stderr, "MIC/GND swap settle delay not recorded\n");
+		gFailures++;
+	}
+
+	printf("%-10s %u MIC/GND swaps: %.1f transactions, %.1f bytes read, %.1f us total per swap, %u us max latency, "
+		   "%u us settle%s\n",
+		   Name,
+		   BENCH_SWAP_TOGGLES,
+		   (double)(after->Transactions - before.Transactions) / BENCH_SWAP_TOGGLES,
+		   (double)(after->BytesRead - before.BytesRead) / BENCH_SWAP_TOGGLES,
+		   (after->BusTimeNs - before.BusTimeNs + after->DelayTimeNs - before.DelayTimeNs) / 1000.0 / BENCH_SWAP_TOGGLES,
+		   histogram->MaxUs,
+		   Bench->Chip.SettleDelay.LastActualUs,
+		   Bench->Chip.SettleDelay.LastBatched ? " (whole batch)" : "");
+}
+
+//
+// A transition failing on the bus is recovered in place, a second failure
+// right after it is left alone and one after the rate limit recovered
+// again. The reset settle stays out of the switch settle statistics.
+//
+static VOID
+BenchRunRecovery(
+	BENCH *Bench,
+	const char *Name,
+	BOOLEAN Batched)
+{
+	static const BENCH_ACTION partnerDfp = {"partner-dfp", BenchActionPartner, UsbCPartnerDfp};
+	static const BENCH_ACTION usbcCC2 = {"recover-cc2", BenchActionSwitch, FSA4480_SET_USBC_CC2};
+	static const BENCH_ACTION usbcCC1 = {"recover-cc1", BenchActionSwitch, FSA4480_SET_USBC_CC1};
+	SIM_STATISTICS before;
+	SIM_STATISTICS *after;
+	FSA4480_SETTLE_DELAY settleBefore;
+	NTSTATUS status;
+
+	BenchReset(Bench, FSA4480_SET_USBC_CC1, Batched);
+	BenchApply(Bench, &partnerDfp);
+
+	before = Bench->Sim.Statistics;
+	settleBefore = Bench->Chip.SettleDelay;
+	Bench->Sim.FailTransactions = 1;
+	BenchApply(Bench, &usbcCC2);
+	after = &Bench->Sim.Statistics;
+
+	if (Bench->Chip.SettleDelay.LastRequestedUs != settleBefore.LastRequestedUs ||
+		Bench->Chip.SettleDelay.LastActualUs != settleBefore.LastActualUs ||
+		Bench->Chip.SettleDelay.MaxActualUs != settleBefore.MaxActualUs ||
+		Bench->Chip.SettleDelay.MaxBatchedUs != settleBefore.MaxBatchedUs)
+	{
+		fprintf(stderr, "%s: recovery recorded a %u us settle delay\n",
+				usbcCC2.Name,
+				Bench->Chip.SettleDelay.LastRequestedUs);
+		gFailures++;
+	}
+
+	if (Bench->Chip.Recovery.Attempts != 1 || Bench->Chip.Recovery.Succeeded != 1)
+	{
+		fprintf(stderr, "%s: %u recoveries, %u succeeded\n",
+				usbcCC2.Name,
+				Bench->Chip.Recovery.Attempts,
+				Bench->Chip.Recovery.Succeeded);
+		gFailures++;
+	}
+
+	printf("%-10s recovery: %u transactions, %.1f us from the failed transfer\n",
+		   Name,
+		   after->Transactions - before.Transactions,
+		   (after->BusTimeNs - before.BusTimeNs + after->DelayTimeNs - before.DelayTimeNs) / 1000.0);
+
+	Bench->Sim.FailTransactions = 1;
+	status = FSA4480_Switch(&Bench->Chip, FSA4480_SET_USBC_CC1);
+
+	if (NT_SUCCESS(status) || Bench->Chip.Recovery.Suppressed != 1)
+	{
+		fprintf(stderr, "%s: failure within the rate limit returned 0x%08x, %u suppressed\n",
+				usbcCC1.Name,
+				(unsigned)status,
+				Bench->Chip.Recovery.Suppressed);
+		gFailures++;
+	}
+
+	BenchCheckCache(Bench, usbcCC1.Name);
+
+	Bench->Sim.NowNs += FSA4480_RECOVERY_INTERVAL_MS * 1000000ULL;
+	Bench->Sim.FailTransactions = 1;
+	BenchApply(Bench, &usbcCC1);
+
+	if (Bench->Chip.Recovery.Attempts != 2 || Bench->Chip.Recovery.Succeeded != 2)
+	{
+		fprintf(stderr, "%s: %u recoveries after the rate limit, %u succeeded\n",
+				usbcCC1.Name,
+				Bench->Chip.Recovery.Attempts,
+				Bench->Chip.Recovery.Succeeded);
+		gFailures++;
+	}
+}
+
+//
+// The chip NAKs every transfer while its soft reset runs. Recovery waits
+// FSA4480_RESET_SETTLE_US, a chip busy for less comes back, one busy for
+// longer fails the recovery and the error goes back to the caller.
+//
+static VOID
+BenchRunResetWindow(
+	BENCH *Bench,
+	const char *Name,
+	BOOLEAN Batched)
+{
+	static const BENCH_ACTION partnerDfp = {"partner-dfp", BenchActionPartner, UsbCPartnerDfp};
+	static const ULONG busyUs[] = {FSA4480_RESET_SETTLE_US - 50, FSA4480_RESET_SETTLE_US + 50};
+	NTSTATUS status;
+	BOOLEAN recovers;
+	ULONG i;
+
+	for (i = 0; i < ARRAYSIZE(busyUs); i++)
+	{
+		recovers = busyUs[i] < FSA4480_RESET_SETTLE_US;
+
+		BenchReset(Bench, FSA4480_SET_USBC_CC1, Batched);
+		BenchApply(Bench, &partnerDfp);
+
+		Bench->Sim.ResetBusyUs = busyUs[i];
+		Bench->Sim.FailTransactions = 1;
+		status = FSA4480_Switch(&Bench->Chip, FSA4480_SET_USBC_CC2);
+
+		if (NT_SUCCESS(status) != recovers ||
+			Bench->Chip.Recovery.Attempts != 1 ||
+			Bench->Chip.Recovery.Succeeded != (recovers ? 1U : 0U))
+		{
+			fprintf(stderr, "%s reset window of %u us: status 0x%08x, %u recoveries, %u succeeded\n",
+					Name,
+					busyUs[i],
+					(unsigned)status,
+					Bench->Chip.Recovery.Attempts,
+					Bench->Chip.Recovery.Succeeded);
+			gFailures++;
+		}
+
+		BenchCheckCache(Bench, "reset-window");
+	}
+
+	printf("%-10s reset window: recovers with the chip busy for %u us, fails with it busy for %u us\n",
+		   Name,
+		   busyUs[0],
+		   busyUs[1]);
+}
+
+//
+// The register dump is one transaction, matches the chip after a run and
+// catches a register changed behind the driver's back
+//
+static VOID
+BenchCheckDump(
+	BENCH *Bench)
+{
+	FSA4480_REGISTER_DUMP dump;
+	ULONG transactions = Bench->Sim.Statistics.Transactions;
+	NTSTATUS status;
+
+	status = FSA4480_DumpRegisters(&Bench->Chip, TRUE, &dump);
+
+	if (!NT_SUCCESS(status) ||
+		Bench->Sim.Statistics.Transactions - transactions != 1 ||
+		dump.MismatchMask != 0 ||
+		memcmp(dump.Registers, Bench->Sim.Registers, sizeof(dump.Registers)) != 0)
+	{
+		fprintf(stderr,
+				"register dump: status 0x%08x, %u transaction(s), mismatch mask 0x%08x\n",
+				(unsigned)status,
+				(unsigned)(Bench->Sim.Statistics.Transactions - transactions),
+				dump.MismatchMask);
+		gFailures++;
+	}
+
+	Bench->Sim.Registers[FSA4480_SWITCH_CONTROL] ^= 0x01;
+	FSA4480_DumpRegisters(&Bench->Chip, TRUE, &dump);
+	Bench->Sim.Registers[FSA4480_SWITCH_CONTROL] ^= 0x01;
+
+	if (dump.MismatchMask != (1UL << FSA4480_SWITCH_CONTROL))
+	{
+		fprintf(stderr,
+				"register dump: SWITCH_CONTROL changed, mismatch mask 0x%08x\n",
+				dump.MismatchMask);
+		gFailures++;
+	}
+
+	FSA4480_DumpRegisters(&Bench->Chip, FALSE, &dump);
+
+	if (dump.Status != STATUS_DEVICE_POWERED_OFF ||
+		dump.ExpectedValidMask != Bench->Chip.RegisterCache.ValidMask)
+	{
+		fprintf(stderr, "register dump: gated chip read\n");
+		gFailures++;
+	}
+}
+
+int
+main(
+	int argc,
+	char *argv[])
+{
+	BENCH *bench;
+	SIM_STATISTICS batched;
+	SIM_STATISTICS unbatched;
+	ULONG rows;
+
+	UNREFERENCED_PARAMETER(argc);
+	UNREFERENCED_PARAMETER(argv);
+
+	bench = (BENCH *)calloc(1, sizeof(*bench));
+	if (bench == NULL)
+	{
+		return 1;
+	}
+
+	printf("%-18s %-18s %6s %6s %6s %10s %10s %6s\n",
+		   "From", "To", "xfers", "wr(B)", "rd(B)", "bus(us)", "total(us)", "live");
+
+	rows = BenchRunMatrix(bench, TRUE, TRUE, &batched);
+	BenchRunMatrix(bench, FALSE, FALSE, &unbatched);
+
+	printf("\n");
+	BenchPrintTotals("batched", rows, &batched);
+	BenchPrintTotals("unbatched", rows, &unbatched);
+	BenchRunSwapToggles(bench, "batched", TRUE);
+	BenchRunSwapToggles(bench, "unbatched", FALSE);
+	BenchRunRecovery(bench, "batched", TRUE);
+	BenchRunRecovery(bench, "unbatched", FALSE);
+	BenchCheckDump(bench);
+	BenchRunResetWindow(bench, "batched", TRUE);
+	BenchRunResetWindow(bench, "unbatched", FALSE);
+
+	free(bench);
+
+	if (gFailures != 0)
+	{
+		fprintf(stderr, "%d check(s) failed\n", gFailures);
+		return 1;
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,392 @@
+/*++
+
+Module Name:
+
+	fsa4480sim.c
+
+Abstract:
+
+	Simulated FSA4480 register file and I2C bus cost model.
+
+	The model covers what the driver depends on:
+
+	- register reset values (registers not listed below reset to 0x00)
+	- address auto-increment for multi-byte reads and writes
+	- read-only status registers and the self-clearing RESET register,
+	  with transfers NAKed for ResetBusyUs after a reset
+	- SWITCH_STATUS1 derived from SWITCH_SETTINGS and SWITCH_CONTROL:
+	  with the device and both SBU switches enabled it reports 0x23 for
+	  the CC1 orientation and 0x1C for CC2 (SWITCH_CONTROL bits 5-6 set),
+	  otherwise 0x00
+
+Environment:
+
+	Host (Linux, user mode)
+
+--*/
+
+#include "fsa4480sim.h"
+
+#define SIM_DEVICE_ID 0x09
+
+#define SIM_SETTINGS_DEVICE_ENABLE 0x80
+#define SIM_SETTINGS_SBU_ENABLE 0x60
+#define SIM_CONTROL_SBU_SWAP 0x60
+
+#define SIM_RESET_BIT 0x01
+
+typedef struct _SIM_REGISTER_VALUE
+{
+	BYTE Address;
+	BYTE Value;
+} SIM_REGISTER_VALUE;
+
+static const SIM_REGISTER_VALUE gSimResetValues[] =
+	{
+		{FSA4480_DEVICE_ID, SIM_DEVICE_ID},
+		{FSA4480_SWITCH_SETTINGS, 0x98},
+		{FSA4480_SWITCH_CONTROL, 0x18},
+};
+
+static BOOLEAN
+SimIsReadOnly(
+	BYTE Address)
+{
+	return Address == FSA4480_DEVICE_ID ||
+		   Address == FSA4480_SWITCH_STATUS0 ||
+		   Address == FSA4480_SWITCH_STATUS1 ||
+		   Address == FSA4480_JACK_STATUS ||
+		   Address == FSA4480_DETECTION_INT;
+}
+
+//
+// A SWITCH_CONTROL write reroutes a live switch when it changes the routing
+// bit of a switch enabled in SWITCH_SETTINGS
+//
+static BOOLEAN
+SimReroutesLiveSwitch(
+	SIM_CHIP *Sim,
+	BYTE SwitchControl)
+{
+	BYTE settings = Sim->Registers[FSA4480_SWITCH_SETTINGS];
+
+	if ((settings & SIM_SETTINGS_DEVICE_ENABLE) == 0)
+	{
+		return FALSE;
+	}
+
+	return ((Sim->Registers[FSA4480_SWITCH_CONTROL] ^ SwitchControl) & settings & 0x7F) != 0;
+}
+
+static VOID
+SimUpdateStatus(
+	SIM_CHIP *Sim)
+{
+	BYTE settings = Sim->Registers[FSA4480_SWITCH_SETTINGS];
+	BYTE control = Sim->Registers[FSA4480_SWITCH_CONTROL];
+
+	if ((settings & SIM_SETTINGS_DEVICE_ENABLE) != 0 &&
+		(settings & SIM_SETTINGS_SBU_ENABLE) == SIM_SETTINGS_SBU_ENABLE)
+	{
+		Sim->Registers[FSA4480_SWITCH_STATUS1] =
+			(control & SIM_CONTROL_SBU_SWAP) == SIM_CONTROL_SBU_SWAP ? 0x1C : 0x23;
+	}
+	else
+	{
+		Sim->Registers[FSA4480_SWITCH_STATUS1] = 0x00;
+	}
+}
+
+static VOID
+SimChargeTransaction(
+	SIM_CHIP *Sim,
+	ULONG BitTimes)
+{
+	ULONGLONG costNs;
+
+	costNs = (ULONGLONG)BitTimes * 1000000000ULL / Sim->Cost.BusClockHz +
+			 Sim->Cost.TransactionOverheadNs;
+
+	Sim->Statistics.Transactions++;
+	Sim->Statistics.BusTimeNs += costNs;
+	Sim->NowNs += costNs;
+}
+
+VOID
+SimChipReset(
+	SIM_CHIP *Sim)
+{
+	ULONG i;
+
+	memset(Sim->Registers, 0, sizeof(Sim->Registers));
+
+	for (i = 0; i < ARRAYSIZE(gSimResetValues); i++)
+	{
+		Sim->Registers[gSimResetValues[i].Address] = gSimResetValues[i].Value;
+	}
+
+	SimUpdateStatus(Sim);
+}
+
+VOID
+SimChipInitialize(
+	SIM_CHIP *Sim)
+{
+	memset(Sim, 0, sizeof(*Sim));
+
+	Sim->Cost.BusClockHz = SIM_DEFAULT_BUS_CLOCK_HZ;
+	Sim->Cost.TransactionOverheadNs = SIM_DEFAULT_TRANSACTION_OVERHEAD_NS;
+
+	SimChipReset(Sim);
+}
+
+static VOID
+SimApplyWrite(
+	SIM_CHIP *Sim,
+	BYTE Address,
+	BYTE *Data,
+	ULONG Length)
+{
+	ULONG i;
+	BYTE registerAddress;
+
+	Sim->Statistics.BytesWritten += 1 + Length;
+
+	for (i = 0; i < Length; i++)
+	{
+		registerAddress = (BYTE)((Address + i) % FSA4480_REGISTER_COUNT);
+
+		if (SimIsReadOnly(registerAddress))
+		{
+			continue;
+		}
+
+		if (registerAddress == FSA4480_RESET)
+		{
+			if ((Data[i] & SIM_RESET_BIT) != 0)
+			{
+				SimChipReset(Sim);
+				Sim->ResetBusyUntilNs = Sim->NowNs + (ULONGLONG)Sim->ResetBusyUs * 1000;
+			}
+
+			continue;
+		}
+
+		if (registerAddress == FSA4480_SWITCH_CONTROL && SimReroutesLiveSwitch(Sim, Data[i]))
+		{
+			Sim->Statistics.LiveControlWrites++;
+		}
+
+		Sim->Registers[registerAddress] = Data[i];
+	}
+
+	SimUpdateStatus(Sim);
+}
+
+static VOID
+SimApplyRead(
+	SIM_CHIP *Sim,
+	BYTE Address,
+	BYTE *Data,
+	ULONG Length)
+{
+	ULONG i;
+
+	Sim->Statistics.BytesWritten += 1;
+	Sim->Statistics.BytesRead += Length;
+
+	for (i = 0; i < Length; i++)
+	{
+		Data[i] = Sim->Registers[(Address + i) % FSA4480_REGISTER_COUNT];
+	}
+}
+
+static BOOLEAN
+SimIsResetting(
+	SIM_CHIP *Sim)
+{
+	return Sim->NowNs < Sim->ResetBusyUntilNs;
+}
+
+static BOOLEAN
+SimTakeFailure(
+	SIM_CHIP *Sim,
+	ULONG BitTimes)
+{
+	if (Sim->FailTransactions == 0 && !SimIsResetting(Sim))
+	{
+		return FALSE;
+	}
+
+	if (Sim->FailTransactions != 0)
+	{
+		Sim->FailTransactions--;
+	}
+
+	SimChargeTransaction(Sim, BitTimes);
+
+	return TRUE;
+}
+
+//
+// Time on the wire inside a sequence, the transaction itself is charged
+// once at its end
+//
+static VOID
+SimAdvance(
+	SIM_CHIP *Sim,
+	ULONG BitTimes)
+{
+	ULONGLONG costNs;
+
+	costNs = (ULONGLONG)BitTimes * 1000000000ULL / Sim->Cost.BusClockHz;
+
+	Sim->Statistics.BusTimeNs += costNs;
+	Sim->NowNs += costNs;
+}
+
+static NTSTATUS
+SimBusWrite(
+	PVOID Context,
+	BYTE Address,
+	BYTE *Data,
+	ULONG Length)
+{
+	SIM_CHIP *Sim = (SIM_CHIP *)Context;
+
+	//
+	// START, slave address, register address, payload, STOP
+	//
+	if (SimTakeFailure(Sim, 1 + 9 + 9 + 9 * Length + 1))
+	{
+		return STATUS_IO_DEVICE_ERROR;
+	}
+
+	SimChargeTransaction(Sim, 1 + 9 + 9 + 9 * Length + 1);
+	SimApplyWrite(Sim, Address, Data, Length);
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+SimBusRead(
+	PVOID Context,
+	BYTE Address,
+	BYTE *Data,
+	ULONG Length)
+{
+	SIM_CHIP *Sim = (SIM_CHIP *)Context;
+
+	//
+	// START, slave address, register address, repeated START, slave
+	// address, payload, STOP
+	//
+	if (SimTakeFailure(Sim, 1 + 9 + 9 + 1 + 9 + 9 * Length + 1))
+	{
+		return STATUS_IO_DEVICE_ERROR;
+	}
+
+	SimChargeTransaction(Sim, 1 + 9 + 9 + 1 + 9 + 9 * Length + 1);
+	SimApplyRead(Sim, Address, Data, Length);
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+SimBusDelay(
+	PVOID Context,
+	ULONG Microseconds)
+{
+	SIM_CHIP *Sim = (SIM_CHIP *)Context;
+
+	Sim->Statistics.DelayTimeNs += (ULONGLONG)Microseconds * 1000;
+	Sim->NowNs += (ULONGLONG)Microseconds * 1000;
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+SimBusExecute(
+	PVOID Context,
+	PFSA4480_STEP Steps,
+	ULONG StepCount)
+{
+	SIM_CHIP *Sim = (SIM_CHIP *)Context;
+	ULONG bitTimes;
+	ULONG i;
+
+	//
+	// A NACK on the first transfer, nothing of the sequence is applied
+	//
+	if (SimTakeFailure(Sim, 1 + 9 + 1))
+	{
+		return STATUS_IO_DEVICE_ERROR;
+	}
+
+	//
+	// One Spb sequence: every transfer starts with a (repeated) START and
+	// the slave address, a read first writes its register address, a
+	// single STOP ends the sequence. The controller waits out the settle
+	// delays between transfers. A transfer NAKed by a resetting chip ends
+	// the sequence, the transfers before it stay applied.
+	//
+	for (i = 0; i < StepCount; i++)
+	{
+		if (Steps[i].Type != FSA4480_STEP_SETTLE && SimIsResetting(Sim))
+		{
+			SimChargeTransaction(Sim, 1 + 9 + 1);
+			return STATUS_IO_DEVICE_ERROR;
+		}
+
+		switch (Steps[i].Type)
+		{
+		case FSA4480_STEP_WRITE:
+			bitTimes = 1 + 9 + 9 + 9 * Steps[i].Count;
+			SimAdvance(Sim, bitTimes);
+			SimApplyWrite(Sim, Steps[i].Address, Steps[i].Values, Steps[i].Count);
+			break;
+		case FSA4480_STEP_READ:
+			bitTimes = 1 + 9 + 9 + 1 + 9 + 9 * Steps[i].Count;
+			SimAdvance(Sim, bitTimes);
+			SimApplyRead(Sim, Steps[i].Address, Steps[i].Values, Steps[i].Count);
+			break;
+		case FSA4480_STEP_SETTLE:
+			Sim->Statistics.DelayTimeNs += (ULONGLONG)Steps[i].DelayUs * 1000;
+			Sim->NowNs += (ULONGLONG)Steps[i].DelayUs * 1000;
+			break;
+		default:
+			return STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	SimChargeTransaction(Sim, 1);
+
+	return STATUS_SUCCESS;
+}
+
+static LONGLONG
+SimBusQueryTime(
+	PVOID Context)
+{
+	SIM_CHIP *Sim = (SIM_CHIP *)Context;
+
+	//
+	// The latency code treats 0 as "not started", never return it
+	//
+	return (LONGLONG)Sim->NowNs + 1;
+}
+
+VOID
+SimChipBindBus(
+	SIM_CHIP *Sim,
+	PFSA4480_BUS Bus,
+	BOOLEAN Batched)
+{
+	Bus->Context = Sim;
+	Bus->Write = SimBusWrite;
+	Bus->Read = SimBusRead;
+	Bus->Delay = SimBusDelay;
+	Bus->QueryTime = SimBusQueryTime;
+	Bus->Execute = Batched ? SimBusExecute : NULL;
+	Bus->TimeFrequency = 1000000000LL;
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+/*++
+
+Module Name:
+
+	fsa4480sim.h
+
+Abstract:
+
+	Simulated FSA4480 register file and I2C bus cost model, used to run
+	the chip logic in fsa4480.c on the host.
+
+Environment:
+
+	Host (Linux, user mode)
+
+--*/
+
+#pragma once
+
+#include "fsa4480.h"
+
+//
+// Bus cost model. A byte on the wire takes 9 bit times (8 data bits and
+// the ACK), START, repeated START and STOP take one bit time each.
+// TransactionOverheadNs is the fixed software cost of one trip through
+// the Spb I/O stack, paid once per transaction.
+//
+typedef struct _SIM_BUS_COST
+{
+	ULONG BusClockHz;
+	ULONG TransactionOverheadNs;
+} SIM_BUS_COST;
+
+#define SIM_DEFAULT_BUS_CLOCK_HZ 400000
+#define SIM_DEFAULT_TRANSACTION_OVERHEAD_NS 40000
+
+typedef struct _SIM_STATISTICS
+{
+	ULONG Transactions;
+	ULONG BytesWritten;
+	ULONG BytesRead;
+	ULONGLONG BusTimeNs;
+	ULONGLONG DelayTimeNs;
+
+	//
+	// SWITCH_CONTROL writes that rerouted an enabled analog switch
+	//
+	ULONG LiveControlWrites;
+} SIM_STATISTICS;
+
+typedef struct _SIM_CHIP
+{
+	BYTE Registers[FSA4480_REGISTER_COUNT];
+
+	//
+	// Simulated clock, advanced by bus transactions and delays
+	//
+	ULONGLONG NowNs;
+
+	SIM_BUS_COST Cost;
+	SIM_STATISTICS Statistics;
+
+	//
+	// Number of upcoming transactions to fail, they are charged for but
+	// never reach the chip
+	//
+	ULONG FailTransactions;
+
+	//
+	// For ResetBusyUs after a RESET_DEVICE write the chip NAKs every
+	// transfer, up to ResetBusyUntilNs. 0 leaves it responsive.
+	//
+	ULONG ResetBusyUs;
+	ULONGLONG ResetBusyUntilNs;
+} SIM_CHIP;
+
+VOID
+SimChipInitialize(
+	SIM_CHIP *Sim);
+
+VOID
+SimChipReset(
+	SIM_CHIP *Sim);
+
+//
+// With Batched set the bus also implements Execute, so transition
+// programs go out as one sequence each
+//
+VOID
+SimChipBindBus(
+	SIM_CHIP *Sim,
+	PFSA4480_BUS Bus,
+	BOOLEAN Batched);
\ No newline at end of file
@@ -0,0 +1,111 @@
+/*++
+
+Module Name:
+
+	host.h
+
+Abstract:
+
+	Minimal NT definitions needed to build the FSA4480 chip logic
+	(fsa4480.c) as a user mode program with a C99 compiler.
+
+Environment:
+
+	Host (Linux, user mode)
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef void VOID, *PVOID;
+typedef uint8_t UCHAR, *PUCHAR, BYTE, *PBYTE, BOOLEAN, *PBOOLEAN;
+typedef uint16_t USHORT;
+typedef int32_t LONG, *PLONG, NTSTATUS;
+typedef uint32_t ULONG, *PULONG, UINT32, DWORD;
+typedef int64_t LONGLONG, *PLONGLONG;
+typedef uint64_t ULONGLONG, ULONG64;
+typedef uintptr_t ULONG_PTR, SIZE_T;
+
+typedef struct _GUID
+{
+	ULONG Data1;
+	USHORT Data2;
+	USHORT Data3;
+	UCHAR Data4[8];
+} GUID;
+
+#define TRUE 1
+#define FALSE 0
+
+#define __int64 long long
+
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_opt_
+#define _In_reads_bytes_(Size)
+#define _Out_writes_bytes_(Size)
+
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+
+#define STATUS_SUCCESS ((NTSTATUS)0x00000000L)
+#define STATUS_PENDING ((NTSTATUS)0x00000103L)
+#define STATUS_UNSUCCESSFUL ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES ((NTSTATUS)0xC000009AL)
+#define STATUS_INVALID_CONNECTION ((NTSTATUS)0xC0000140L)
+#define STATUS_IO_DEVICE_ERROR ((NTSTATUS)0xC0000185L)
+#define STATUS_INVALID_DEVICE_STATE ((NTSTATUS)0xC0000184L)
+#define STATUS_NOT_SUPPORTED ((NTSTATUS)0xC00000BBL)
+#define STATUS_DEVICE_POWERED_OFF ((NTSTATUS)0xC000048FL)
+
+#define ARRAYSIZE(A) (sizeof(A) / sizeof((A)[0]))
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+
+#define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+#define RtlZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+
+#define InterlockedIncrement(Addend) __atomic_add_fetch((Addend), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(Addend) __atomic_sub_fetch((Addend), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(Target, Value) __atomic_exchange_n((Target), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(Destination, Exchange, Comparand) \
+	__sync_val_compare_and_swap((Destination), (Comparand), (Exchange))
+
+#define DEFINE_GUID(Name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+	static const GUID Name = {l, w1, w2, {b1, b2, b3, b4, b5, b6, b7, b8}}
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+	(((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+#define FILE_DEVICE_UNKNOWN 0x00000022
+#define METHOD_BUFFERED 0
+#define FILE_ANY_ACCESS 0
+#define FILE_READ_ACCESS 1
+#define FILE_WRITE_ACCESS 2
+
+//
+// WPP tracing is not available on the host
+//
+#define TRACE_LEVEL_ERROR 2
+#define TRACE_LEVEL_WARNING 3
+#define TRACE_LEVEL_INFORMATION 4
+#define TRACE_LEVEL_VERBOSE 5
+#define TraceEvents(Level, Flags, ...) ((void)0)
+
+//
+// Neither are TraceLogging events, see events.h. The stubs still consume
+// their arguments, the locals only feeding them are not left unused.
+//
+#define FSA4480_EVENTS_ENABLED(Keyword) FALSE
+#define FSA4480_EVENT_TRANSITION_BEGIN(From, To, StepCount, Batched) \
+	((void)(From), (void)(To), (void)(StepCount), (void)(Batched))
+#define FSA4480_EVENT_TRANSITION_END(From, To, Status, ElapsedTicks) \
+	((void)(From), (void)(To), (void)(Status), (void)(ElapsedTicks))
+#define FSA4480_EVENT_REGISTER_WRITE(Address, Values, Count, Batched, Status, ElapsedTicks) \
+	((void)(Address), (void)(Values), (void)(Count), (void)(Batched), (void)(Status), (void)(ElapsedTicks))
+#define FSA4480_EVENT_STATUS_READ(Address, Value, Batched, Status, ElapsedTicks) \
+	((void)(Address), (void)(Value), (void)(Batched), (void)(Status), (void)(ElapsedTicks))
+#define FSA4480_EVENT_DELAY(RequestedUs, Batched, Status, ElapsedTicks) ((void)(RequestedUs), (void)(Batched), (void)(Status), (void)(ElapsedTicks))
\ No newline at end of file
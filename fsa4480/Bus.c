@@ -0,0 +1,341 @@
+/*++
+
+Module Name:
+
+	bus.c
+
+Abstract:
+
+	This file implements the FSA4480_BUS used by the chip logic in
+	fsa4480.c on top of the Spb I/O target and kernel timers.
+
+Environment:
+
+	Kernel-mode Driver Framework
+
+--*/
+
+#include "driver.h"
+#include "bus.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, fsa4480BusInitialize)
+#pragma alloc_text(PAGE, fsa4480BusDeinitialize)
+#endif
+
+NTSTATUS
+fsa4480BusWrite(
+	PVOID Context,
+	BYTE Address,
+	BYTE *Data,
+	ULONG Length)
+{
+	NTSTATUS status;
+	PDEVICE_CONTEXT deviceContext = (PDEVICE_CONTEXT)Context;
+
+	if (!deviceContext->InitializedSpbHardware)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Spb Hardware is not yet initialized, aborting - %!STATUS!",
+			status);
+
+		goto exit;
+	}
+
+	status = SpbWriteDataSynchronously(
+		&deviceContext->I2CContext,
+		Address,
+		Data,
+		Length);
+
+exit:
+	return status;
+}
+
+NTSTATUS
+fsa4480BusRead(
+	PVOID Context,
+	BYTE Address,
+	BYTE *Data,
+	ULONG Length)
+{
+	NTSTATUS status;
+	PDEVICE_CONTEXT deviceContext = (PDEVICE_CONTEXT)Context;
+
+	if (!deviceContext->InitializedSpbHardware)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Spb Hardware is not yet initialized, aborting - %!STATUS!",
+			status);
+
+		goto exit;
+	}
+
+	status = SpbReadDataSynchronously(
+		&deviceContext->I2CContext,
+		Address,
+		Data,
+		Length);
+
+exit:
+	return status;
+}
+
+NTSTATUS
+fsa4480BusDelay(
+	PVOID Context,
+	ULONG Microseconds)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	PDEVICE_CONTEXT deviceContext = (PDEVICE_CONTEXT)Context;
+	FSA4480_DELAY_STRATEGY strategy;
+	LARGE_INTEGER delay = {0};
+
+	strategy = deviceContext->DelayStrategy;
+	if (strategy == FSA4480_DELAY_AUTO)
+	{
+		strategy = Microseconds <= FSA4480_STALL_THRESHOLD_US
+					   ? FSA4480_DELAY_STALL
+					   : FSA4480_DELAY_HIGH_RESOLUTION_TIMER;
+	}
+
+	if (strategy == FSA4480_DELAY_HIGH_RESOLUTION_TIMER && deviceContext->DelayTimer == NULL)
+	{
+		strategy = FSA4480_DELAY_THREAD_SLEEP;
+	}
+
+	switch (strategy)
+	{
+	case FSA4480_DELAY_STALL:
+	{
+		KeStallExecutionProcessor(Microseconds);
+		break;
+	}
+	case FSA4480_DELAY_HIGH_RESOLUTION_TIMER:
+	{
+		ExSetTimer(
+			deviceContext->DelayTimer,
+			RELATIVE(MICROSECONDS(Microseconds)),
+			0,
+			NULL);
+
+		status = KeWaitForSingleObject(
+			deviceContext->DelayTimer,
+			Executive,
+			KernelMode,
+			FALSE,
+			NULL);
+		break;
+	}
+	default:
+	{
+		delay.QuadPart = RELATIVE(MICROSECONDS(Microseconds));
+		status = KeDelayExecutionThread(KernelMode, TRUE, &delay);
+		break;
+	}
+	}
+
+	return status;
+}
+
+NTSTATUS
+fsa4480BusExecute(
+	PVOID Context,
+	PFSA4480_STEP Steps,
+	ULONG StepCount)
+{
+	NTSTATUS status;
+	PDEVICE_CONTEXT deviceContext = (PDEVICE_CONTEXT)Context;
+	SPB_BATCH_STEP batch[FSA4480_MAX_BATCH_STEPS];
+	ULONG i;
+
+	if (!deviceContext->InitializedSpbHardware)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Spb Hardware is not yet initialized, aborting - %!STATUS!",
+			status);
+
+		goto exit;
+	}
+
+	if (StepCount > ARRAYSIZE(batch))
+	{
+		status = STATUS_INVALID_PARAMETER;
+		goto exit;
+	}
+
+	RtlZeroMemory(batch, sizeof(batch));
+
+	for (i = 0; i < StepCount; i++)
+	{
+		switch (Steps[i].Type)
+		{
+		case FSA4480_STEP_WRITE:
+			batch[i].Type = SpbBatchStepWrite;
+			break;
+		case FSA4480_STEP_READ:
+			batch[i].Type = SpbBatchStepRead;
+			break;
+		default:
+			batch[i].Type = SpbBatchStepDelay;
+			batch[i].DelayUs = Steps[i].DelayUs;
+			continue;
+		}
+
+		batch[i].Address = Steps[i].Address;
+		batch[i].Length = Steps[i].Count;
+		batch[i].Data = Steps[i].Values;
+	}
+
+	//
+	// Settle delays are timed by the controller between transfers, the
+	// delay strategy does not apply to them
+	//
+	status = SpbExecuteBatch(
+		&deviceContext->I2CContext,
+		batch,
+		StepCount);
+
+exit:
+	return status;
+}
+
+LONGLONG
+fsa4480BusQueryTime(
+	PVOID Context)
+{
+	UNREFERENCED_PARAMETER(Context);
+
+	return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+NTSTATUS
+fsa4480BusInitialize(
+	_In_ WDFDEVICE Device)
+/*++
+
+Routine Description:
+
+	Binds the chip logic of the device to its Spb I/O target, with
+	transition programs executed as one Spb sequence each, and
+	allocates the high resolution timer used for other delays. The Spb
+	target itself is opened later, in fsa4480DevicePrepareHardware, bus
+	accesses fail until then.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	PDEVICE_CONTEXT deviceContext;
+	PFSA4480_BUS bus;
+	LARGE_INTEGER frequency;
+	ULONG delayStrategy = FSA4480_DELAY_AUTO;
+	DECLARE_CONST_UNICODE_STRING(delayStrategyValueName, L"DelayStrategy");
+
+	PAGED_CODE();
+
+	deviceContext = DeviceGetContext(Device);
+	bus = &deviceContext->Chip.Bus;
+
+	KeQueryPerformanceCounter(&frequency);
+
+	bus->Context = deviceContext;
+	bus->Write = fsa4480BusWrite;
+	bus->Read = fsa4480BusRead;
+	bus->Delay = fsa4480BusDelay;
+	bus->QueryTime = fsa4480BusQueryTime;
+	bus->Execute = fsa4480BusExecute;
+	bus->TimeFrequency = frequency.QuadPart;
+
+	UtilityQueryDeviceULong(
+		Device,
+		&delayStrategyValueName,
+		&delayStrategy);
+
+	if (delayStrategy >= FSA4480_DELAY_STRATEGY_COUNT)
+	{
+		TraceEvents(
+			TRACE_LEVEL_WARNING,
+			TRACE_DRIVER,
+			"Ignoring unknown delay strategy %d",
+			delayStrategy);
+
+		delayStrategy = FSA4480_DELAY_AUTO;
+	}
+
+	deviceContext->DelayStrategy = (FSA4480_DELAY_STRATEGY)delayStrategy;
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Delay strategy %d",
+		delayStrategy);
+
+	//
+	// Without a timer fsa4480BusDelay falls back to KeDelayExecutionThread
+	//
+	deviceContext->DelayTimer = ExAllocateTimer(
+		NULL,
+		NULL,
+		EX_TIMER_HIGH_RESOLUTION);
+
+	if (deviceContext->DelayTimer == NULL)
+	{
+		TraceEvents(
+			TRACE_LEVEL_WARNING,
+			TRACE_DRIVER,
+			"Could not allocate high resolution timer, delays are tick bound");
+	}
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+fsa4480BusDeinitialize(
+	_In_ WDFDEVICE Device)
+/*++
+
+Routine Description:
+
+	Frees the resources allocated by fsa4480BusInitialize.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	None
+
+--*/
+{
+	PDEVICE_CONTEXT deviceContext;
+
+	PAGED_CODE();
+
+	deviceContext = DeviceGetContext(Device);
+
+	if (deviceContext->DelayTimer != NULL)
+	{
+		ExDeleteTimer(deviceContext->DelayTimer, TRUE, FALSE, NULL);
+		deviceContext->DelayTimer = NULL;
+	}
+}
\ No newline at end of file
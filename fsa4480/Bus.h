@@ -0,0 +1,48 @@
+/*++
+
+Module Name:
+
+	bus.h
+
+Abstract:
+
+	This file contains the definitions binding the FSA4480 chip logic
+	to the Spb I/O target and kernel timers.
+
+Environment:
+
+	Kernel-mode Driver Framework
+
+--*/
+
+#pragma once
+
+//
+// Waits up to this long are spun with KeStallExecutionProcessor, a timer
+// cannot expire that early anyway
+//
+#define FSA4480_STALL_THRESHOLD_US 100
+
+//
+// FSA4480_DELAY_AUTO stalls for waits up to FSA4480_STALL_THRESHOLD_US and
+// uses the high resolution timer above that. FSA4480_DELAY_THREAD_SLEEP is
+// the old KeDelayExecutionThread behavior, which is rounded up to the
+// system timer tick. The DelayStrategy value of the device hardware key
+// selects one, AUTO is used when it is missing or out of range.
+//
+typedef enum _FSA4480_DELAY_STRATEGY
+{
+	FSA4480_DELAY_AUTO,
+	FSA4480_DELAY_STALL,
+	FSA4480_DELAY_HIGH_RESOLUTION_TIMER,
+	FSA4480_DELAY_THREAD_SLEEP,
+	FSA4480_DELAY_STRATEGY_COUNT
+} FSA4480_DELAY_STRATEGY;
+
+NTSTATUS
+fsa4480BusInitialize(
+	_In_ WDFDEVICE Device);
+
+VOID
+fsa4480BusDeinitialize(
+	_In_ WDFDEVICE Device);
\ No newline at end of file
@@ -25,7 +25,13 @@ Environment:
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, fsa4480CreateDevice)
+#pragma alloc_text(PAGE, fsa4480EvtDeviceContextCleanup)
 #pragma alloc_text(PAGE, fsa4480DevicePrepareHardware)
+#pragma alloc_text(PAGE, fsa4480DeviceReleaseHardware)
+#pragma alloc_text(PAGE, fsa4480EvtDeviceD0Exit)
+#pragma alloc_text(PAGE, UtilityQueryDeviceULong)
+#pragma alloc_text(PAGE, UtilityQueryProfiles)
+#pragma alloc_text(PAGE, UtilityStartChip)
 #endif
 
 NTSTATUS UtilitySetGPIO(
@@ -53,6 +59,177 @@ exit:
 	return status;
 }
 
+NTSTATUS UtilityGetGPIO(
+	WDFIOTARGET GpioIoTarget,
+	UCHAR *Value)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	WDF_MEMORY_DESCRIPTOR outputDescriptor;
+	UCHAR Buffer[1] = {0};
+
+	if (GpioIoTarget == NULL)
+	{
+		status = STATUS_INVALID_HANDLE;
+		goto exit;
+	}
+
+	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(&outputDescriptor, (PVOID)&Buffer, sizeof(Buffer));
+
+	status = WdfIoTargetSendIoctlSynchronously(GpioIoTarget, NULL, IOCTL_GPIO_READ_PINS, NULL, &outputDescriptor, NULL, NULL);
+
+	if (NT_SUCCESS(status))
+	{
+		*Value = Buffer[0] & 1;
+	}
+
+exit:
+	return status;
+}
+
+NTSTATUS UtilityQueryDeviceULong(
+	WDFDEVICE Device,
+	PCUNICODE_STRING ValueName,
+	PULONG Value)
+{
+	NTSTATUS status;
+	WDFKEY key;
+
+	PAGED_CODE();
+
+	//
+	// Per device settings live in the device hardware key, Value is left
+	// alone when there is none
+	//
+	status = WdfDeviceOpenRegistryKey(
+		Device,
+		PLUGPLAY_REGKEY_DEVICE,
+		KEY_READ,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&key);
+
+	if (!NT_SUCCESS(status))
+	{
+		return status;
+	}
+
+	status = WdfRegistryQueryULong(key, ValueName, Value);
+
+	WdfRegistryClose(key);
+
+	return status;
+}
+
+VOID
+UtilityQueryProfiles(
+	WDFDEVICE Device)
+{
+	NTSTATUS status;
+	WDFKEY key;
+	ULONG i;
+	ULONG profile;
+	ULONG valueLength;
+	ULONG valueType;
+	BYTE values[FSA4480_PROFILE_REGISTER_COUNT];
+	PFSA4480_PROFILE_TABLE profileTable = &DeviceGetContext(Device)->Chip.ProfileTable;
+	static const UNICODE_STRING profileValueNames[FSA4480_PROFILE_COUNT] =
+		{
+			RTL_CONSTANT_STRING(L"FastProfile"),
+			RTL_CONSTANT_STRING(L"BalancedProfile"),
+			RTL_CONSTANT_STRING(L"QuietProfile"),
+	};
+	static const UNICODE_STRING selectionValueNames[FSA4480_PROFILE_USAGE_COUNT] =
+		{
+			RTL_CONSTANT_STRING(L"UsbProfile"),
+			RTL_CONSTANT_STRING(L"DisplayPortProfile"),
+			RTL_CONSTANT_STRING(L"AudioAccessoryProfile"),
+	};
+
+	PAGED_CODE();
+
+	FSA4480_InitializeProfiles(profileTable);
+
+	status = WdfDeviceOpenRegistryKey(
+		Device,
+		PLUGPLAY_REGKEY_DEVICE,
+		KEY_READ,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&key);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	//
+	// A profile value is a REG_BINARY image of SLOW_L to DELAY_L_AGND and
+	// replaces the built-in one, a selection value is the FSA4480_PROFILE
+	// a kind of partner uses
+	//
+	for (i = 0; i < FSA4480_PROFILE_COUNT; i++)
+	{
+		status = WdfRegistryQueryValue(
+			key,
+			&profileValueNames[i],
+			sizeof(values),
+			values,
+			&valueLength,
+			&valueType);
+
+		if (NT_SUCCESS(status) &&
+			valueType == REG_BINARY &&
+			valueLength == sizeof(values))
+		{
+			RtlCopyMemory(profileTable->Profiles[i], values, sizeof(values));
+		}
+		else if (status != STATUS_OBJECT_NAME_NOT_FOUND)
+		{
+			TraceEvents(
+				TRACE_LEVEL_WARNING,
+				TRACE_DRIVER,
+				"Ignoring profile %d, expected %d bytes of REG_BINARY - %!STATUS!",
+				i,
+				(ULONG)sizeof(values),
+				status);
+		}
+	}
+
+	for (i = 0; i < FSA4480_PROFILE_USAGE_COUNT; i++)
+	{
+		status = WdfRegistryQueryULong(key, &selectionValueNames[i], &profile);
+
+		if (NT_SUCCESS(status) && profile < FSA4480_PROFILE_COUNT)
+		{
+			profileTable->Selection[i] = (BYTE)profile;
+		}
+	}
+
+	WdfRegistryClose(key);
+
+exit:
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Profiles: USB %d, DisplayPort %d, audio accessory %d",
+		profileTable->Selection[FSA4480_PROFILE_USAGE_USB],
+		profileTable->Selection[FSA4480_PROFILE_USAGE_DISPLAYPORT],
+		profileTable->Selection[FSA4480_PROFILE_USAGE_AUDIO_ACCESSORY]);
+}
+
+FSA4480_SWITCH_MODE
+UtilityCCOutToSwitchMode(
+	ULONG CCOut)
+{
+	switch (CCOut)
+	{
+	case CC_OUT_CC1:
+		return FSA4480_SET_USBC_CC1;
+	case CC_OUT_CC2:
+		return FSA4480_SET_USBC_CC2;
+	default:
+		return FSA4480_SET_DP_DISCONNECTED;
+	}
+}
+
 NTSTATUS UtilityOpenIOTarget(
 	PDEVICE_CONTEXT DeviceContext,
 	LARGE_INTEGER Resource,
@@ -103,6 +280,107 @@ NTSTATUS UtilityOpenIOTarget(
 	return status;
 }
 
+VOID
+USBCCChangeApply(
+	WDFDEVICE Device)
+{
+	PDEVICE_CONTEXT deviceContext;
+	LONG ccOut;
+
+	deviceContext = (PDEVICE_CONTEXT)DeviceGetContext(Device);
+
+	//
+	// Values are picked up under the lock so the worker and the CC_OUT
+	// interrupt handler cannot apply them out of order. Notifications that
+	// arrive while a switch is in progress replace the pending value, only
+	// the latest one is applied once we get back here.
+	//
+	WdfWaitLockAcquire(deviceContext->ChipLock, NULL);
+
+	//
+	// Before the chip is ready values stay pending, UtilityStartChip calls
+	// back here once it is
+	//
+	while (deviceContext->InitializedFSAHardware &&
+		   (ccOut = InterlockedExchange(&deviceContext->PendingCCOUT, CC_OUT_NONE)) != CC_OUT_NONE)
+	{
+		deviceContext->CCOUT = (ULONG)ccOut;
+
+		//
+		// Powers the chip back up for an attach, or arms the gate timer
+		// for a detach
+		//
+		fsa4480PowerGateUpdate(Device, FALSE);
+
+		FSA4480_BeginSwitchTiming(
+			&deviceContext->Chip,
+			(FSA4480_LATENCY_SOURCE)InterlockedCompareExchange(&deviceContext->PendingSource, 0, 0),
+			InterlockedCompareExchange64(&deviceContext->PendingNotifyTime, 0, 0));
+
+		if (deviceContext->PowerGate.Gated)
+		{
+			//
+			// Still detached and unpowered, there is nothing to switch
+			//
+		}
+		else if (deviceContext->CCOUT <= CC_OUT_OPEN)
+		{
+			FSA4480_Switch(
+				&deviceContext->Chip,
+				UtilityCCOutToSwitchMode(deviceContext->CCOUT));
+		}
+
+		InterlockedIncrement(&deviceContext->CCNotificationsApplied);
+	}
+
+	WdfWaitLockRelease(deviceContext->ChipLock);
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"%!FUNC!: CC notifications received = %d, applied = %d, coalesced = %d",
+		deviceContext->CCNotificationsReceived,
+		deviceContext->CCNotificationsApplied,
+		deviceContext->CCNotificationsCoalesced);
+}
+
+VOID
+USBCCChangeWorkItem(
+	WDFWORKITEM WorkItem)
+{
+	WDFDEVICE device = (WDFDEVICE)WdfWorkItemGetParentObject(WorkItem);
+
+	USBCCChangeApply(device);
+}
+
+VOID
+USBCCChangePublish(
+	PDEVICE_CONTEXT DeviceContext,
+	LONG CCOut,
+	FSA4480_LATENCY_SOURCE Source,
+	LONGLONG ArrivalTime)
+{
+	LONG previousCCOUT;
+
+	InterlockedIncrement(&DeviceContext->CCNotificationsReceived);
+
+	//
+	// Publish the source and arrival time before the value, the worker
+	// picks up the value first and the rest after it
+	//
+	InterlockedExchange(&DeviceContext->PendingSource, (LONG)Source);
+	InterlockedExchange64(&DeviceContext->PendingNotifyTime, ArrivalTime);
+
+	previousCCOUT = InterlockedExchange(&DeviceContext->PendingCCOUT, CCOut);
+	if (previousCCOUT != CC_OUT_NONE)
+	{
+		//
+		// The worker has not picked up the previous value yet, it is stale now
+		//
+		InterlockedIncrement(&DeviceContext->CCNotificationsCoalesced);
+	}
+}
+
 VOID
 USBCCChangeNotifyCallback(
 	PVOID   NotificationContext,
@@ -111,6 +389,11 @@ USBCCChangeNotifyCallback(
 {
 	PDEVICE_CONTEXT deviceContext;
 	WDFDEVICE device = (WDFDEVICE)NotificationContext;
+	LONGLONG arrivalTime = KeQueryPerformanceCounter(NULL).QuadPart;
+	LONGLONG edgeTime;
+	LONGLONG acpiTime;
+	LONG edgeCCOut;
+	LARGE_INTEGER frequency;
 
 	//
 	// CC_OUT:
@@ -127,20 +410,116 @@ USBCCChangeNotifyCallback(
 		return;
 	}
 
-	deviceContext->CCOUT = NotifyCode;
+	//
+	// Every notification consumes the edge, so an edge the firmware never
+	// confirmed cannot swallow a later notification. The interrupt writes
+	// the time last, read it first.
+	//
+	edgeTime = InterlockedExchange64(&deviceContext->LastEdgeTime, 0);
+	edgeCCOut = InterlockedExchange(&deviceContext->LastEdgeCCOUT, CC_OUT_NONE);
+	acpiTime = InterlockedExchange64(&deviceContext->LastAcpiTime, arrivalTime);
 
-	if (deviceContext->CCOUT == 2)
+	//
+	// The CC_OUT interrupt already applied this orientation after the last
+	// notification, only measure how far behind the firmware was
+	//
+	if (edgeTime != 0 &&
+		edgeTime > acpiTime &&
+		(LONG)NotifyCode == edgeCCOut)
 	{
-		FSA4480_Switch(device, FSA4480_SET_DP_DISCONNECTED);
+		KeQueryPerformanceCounter(&frequency);
+
+		FSA4480_RecordLatency(
+			&deviceContext->Chip.SwitchLatency.AcpiLag,
+			(ULONG)((arrivalTime - edgeTime) * 1000000 / frequency.QuadPart));
+
+		return;
 	}
-	else if (deviceContext->CCOUT == 0)
+
+	USBCCChangePublish(
+		deviceContext,
+		(LONG)NotifyCode,
+		FSA4480_LATENCY_SOURCE_ACPI,
+		arrivalTime);
+
+	WdfWorkItemEnqueue(deviceContext->CCChangeWorkItem);
+}
+
+BOOLEAN
+fsa4480EvtCCOutInterruptIsr(
+	_In_ WDFINTERRUPT Interrupt,
+	_In_ ULONG MessageID)
+/*++
+
+Routine Description:
+
+	Passive level handler of the CC_OUT edge interrupt. Samples the pin and,
+	when it reads high, applies CC2 right here, without the ACPI
+	notification and work item round trips. A low pin is either a CC1
+	attach, which makes no edge when the pin was already low, or a CC2
+	detach. The edge cannot tell them apart, both still come through
+	ACPI.
+
+Arguments:
+
+	Interrupt - Handle to the CC_OUT interrupt object.
+
+	MessageID - Unused, the interrupt is line based.
+
+Return Value:
+
+	TRUE, the interrupt is not shared.
+
+--*/
+{
+	WDFDEVICE device = WdfInterruptGetDevice(Interrupt);
+	PDEVICE_CONTEXT deviceContext = DeviceGetContext(device);
+	LONGLONG arrivalTime = KeQueryPerformanceCounter(NULL).QuadPart;
+	NTSTATUS status;
+	UCHAR ccOutLevel = 0;
+	LONG ccOut;
+
+	UNREFERENCED_PARAMETER(MessageID);
+
+	status = UtilityGetGPIO(deviceContext->CCOutGpio, &ccOutLevel);
+
+	if (!NT_SUCCESS(status))
 	{
-		FSA4480_Switch(device, FSA4480_SET_USBC_CC1);
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error reading CC_OUT gpio - %!STATUS!",
+			status);
+
+		return TRUE;
 	}
-	else if (deviceContext->CCOUT == 1)
+
+	if (!ccOutLevel)
 	{
-		FSA4480_Switch(device, FSA4480_SET_USBC_CC2);
+		TraceEvents(
+			TRACE_LEVEL_VERBOSE,
+			TRACE_DRIVER,
+			"%!FUNC!: CC OUT low, left to ACPI");
+
+		return TRUE;
 	}
+
+	ccOut = CC_OUT_CC2;
+
+	TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC!: CC OUT Status = %d\n", ccOut);
+
+	InterlockedExchange(&deviceContext->LastEdgeCCOUT, ccOut);
+	InterlockedExchange64(&deviceContext->LastEdgeTime, arrivalTime);
+
+	USBCCChangePublish(
+		deviceContext,
+		ccOut,
+		FSA4480_LATENCY_SOURCE_GPIO,
+		arrivalTime);
+
+	USBCCChangeApply(device);
+
+	return TRUE;
 }
 
 NTSTATUS
@@ -194,6 +573,7 @@ RegisterForUSBCCChangeNotification(
 			"Error registering for ACPI interface notifications - 0x%08lX",
 			status);
 
+		ACPIInterface->InterfaceDereference(ACPIInterface->Context);
 		goto exit;
 	}
 
@@ -203,6 +583,151 @@ exit:
 	return status;
 }
 
+NTSTATUS
+UtilityStartChip(
+	WDFDEVICE Device)
+/*++
+
+Routine Description:
+
+	Powers the FSA4480 through EN, programs the chip open, then applies
+	the CC changes queued while that was going on. Runs at the end of
+	fsa4480DevicePrepareHardware or, with asynchronous start, from
+	StartWorkItem.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	NTSTATUS status;
+	PDEVICE_CONTEXT devContext = DeviceGetContext(Device);
+	SPB_STATISTICS spbStatistics;
+	LARGE_INTEGER frequency;
+
+	PAGED_CODE();
+
+	//
+	// CC changes arriving meanwhile stay pending until the chip is ready
+	// and are applied on top of the open configuration
+	//
+	WdfWaitLockAcquire(devContext->ChipLock, NULL);
+
+	// Enable by setting the pin LOW.
+	status = UtilitySetGPIO(devContext->EnGpio, 0);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error setting enable gpio to low - %!STATUS!",
+			status);
+
+		goto exit;
+	}
+
+	//
+	// Start open, in USB safe mode. The CC_OUT pin only carries the
+	// orientation, low is CC1 and high is CC2, and reads low on an empty
+	// port too. Nothing tells the driver at this point whether a partner
+	// is attached, so the attach comes through ACPI like any later one.
+	//
+	devContext->CCOUT = CC_OUT_OPEN;
+	devContext->StartStatistics.InitialCCOut = devContext->CCOUT;
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Initializing FSA4480, CC OUT Status = %d",
+		devContext->CCOUT);
+
+	status = FSA4480_Initialize(
+		&devContext->Chip,
+		UtilityCCOutToSwitchMode(devContext->CCOUT));
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error in FSA4480 initialization - %!STATUS!",
+			status);
+
+		goto exit;
+	}
+
+	devContext->InitializedFSAHardware = TRUE;
+
+	KeQueryPerformanceCounter(&frequency);
+
+	devContext->StartStatistics.StartToSwitchedUs =
+		(ULONGLONG)(KeQueryPerformanceCounter(NULL).QuadPart - devContext->PrepareHardwareStartTime) *
+		1000000 / frequency.QuadPart;
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Mux switched %I64u us after start",
+		devContext->StartStatistics.StartToSwitchedUs);
+
+	fsa4480PowerGateStart(Device);
+
+	//
+	// With asynchronous start D0Entry found the chip not ready and left
+	// the gate alone, apply the policy to the open port now
+	//
+	fsa4480PowerGateUpdate(Device, FALSE);
+
+exit:
+	devContext->StartStatistics.ChipStatus = status;
+
+	//
+	// The Spb context is (re)created by fsa4480DevicePrepareHardware, so
+	// its counters only cover the bus traffic of this start.
+	//
+	SpbGetStatistics(&devContext->I2CContext, &spbStatistics);
+	KeQueryPerformanceCounter(&frequency);
+
+	devContext->StartStatistics.Transactions = spbStatistics.Transactions;
+	devContext->StartStatistics.BusTimeUs =
+		(ULONGLONG)spbStatistics.BusTime * 1000000 / frequency.QuadPart;
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Start used %d I2C transactions, %I64u us on the bus",
+		devContext->StartStatistics.Transactions,
+		devContext->StartStatistics.BusTimeUs);
+
+	WdfWaitLockRelease(devContext->ChipLock);
+
+	if (NT_SUCCESS(status))
+	{
+		USBCCChangeApply(Device);
+	}
+
+	return status;
+}
+
+VOID
+UtilityStartWorkItem(
+	WDFWORKITEM WorkItem)
+{
+	WDFDEVICE device = (WDFDEVICE)WdfWorkItemGetParentObject(WorkItem);
+
+	//
+	// Nothing is left to fail the start with, the device keeps running
+	// without the chip and StartStatistics.ChipStatus tells why
+	//
+	UtilityStartChip(device);
+}
+
 NTSTATUS
 fsa4480CreateDevice(
 	_Inout_ PWDFDEVICE_INIT DeviceInit)
@@ -229,6 +754,10 @@ Return Value:
 	WDFDEVICE device;
 	NTSTATUS status;
 	WDF_PNPPOWER_EVENT_CALLBACKS PnpPowerCallbacks;
+	WDF_WORKITEM_CONFIG workItemConfig;
+	WDF_OBJECT_ATTRIBUTES workItemAttributes;
+	DECLARE_CONST_UNICODE_STRING(ccOutInterruptValueName, L"CCOutInterrupt");
+	DECLARE_CONST_UNICODE_STRING(asyncStartValueName, L"AsyncStart");
 
 	PAGED_CODE();
 
@@ -239,9 +768,13 @@ Return Value:
 
 	WDF_PNPPOWER_EVENT_CALLBACKS_INIT(&PnpPowerCallbacks);
 	PnpPowerCallbacks.EvtDevicePrepareHardware = fsa4480DevicePrepareHardware;
+	PnpPowerCallbacks.EvtDeviceReleaseHardware = fsa4480DeviceReleaseHardware;
+	PnpPowerCallbacks.EvtDeviceD0Entry = fsa4480EvtDeviceD0Entry;
+	PnpPowerCallbacks.EvtDeviceD0Exit = fsa4480EvtDeviceD0Exit;
 	WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &PnpPowerCallbacks);
 
 	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&deviceAttributes, DEVICE_CONTEXT);
+	deviceAttributes.EvtCleanupCallback = fsa4480EvtDeviceContextCleanup;
 
 	status = WdfDeviceCreate(&DeviceInit, &deviceAttributes, &device);
 
@@ -262,18 +795,140 @@ Return Value:
 		// Initialize the context.
 		//
 		deviceContext->Device = device;
+		deviceContext->PendingCCOUT = CC_OUT_NONE;
+		deviceContext->LastEdgeCCOUT = CC_OUT_NONE;
+
+		status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &deviceContext->ChipLock);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_DRIVER,
+				"Error creating chip lock - %!STATUS!",
+				status);
+
+			goto exit;
+		}
+
+		status = fsa4480BusInitialize(device);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_DRIVER,
+				"Error initializing FSA4480 bus - %!STATUS!",
+				status);
+
+			goto exit;
+		}
+
+		UtilityQueryDeviceULong(
+			device,
+			&ccOutInterruptValueName,
+			&deviceContext->CCOutInterruptEnabled);
+
+		UtilityQueryDeviceULong(
+			device,
+			&asyncStartValueName,
+			&deviceContext->AsyncStartEnabled);
+
+		UtilityQueryProfiles(device);
+
+		status = fsa4480PowerGateInitialize(device);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		//
+		// Expose the diagnostic IOCTLs
+		//
+		status = WdfDeviceCreateDeviceInterface(
+			device,
+			&GUID_DEVINTERFACE_fsa4480,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_DRIVER,
+				"Error creating device interface - %!STATUS!",
+				status);
+
+			goto exit;
+		}
+
+		//
+		// Let UCM and audio drivers drive the mux directly
+		//
+		status = fsa4480InterfaceInitialize(device);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		status = fsa4480QueueInitialize(device);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_DRIVER,
+				"Error initializing queue - %!STATUS!",
+				status);
+
+			goto exit;
+		}
+
+		//
+		// Create the worker that applies CC changes outside of the ACPI
+		// notification context
+		//
+		WDF_WORKITEM_CONFIG_INIT(&workItemConfig, USBCCChangeWorkItem);
+		workItemConfig.AutomaticSerialization = FALSE;
+
+		WDF_OBJECT_ATTRIBUTES_INIT(&workItemAttributes);
+		workItemAttributes.ParentObject = device;
+
+		status = WdfWorkItemCreate(
+			&workItemConfig,
+			&workItemAttributes,
+			&deviceContext->CCChangeWorkItem);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_DRIVER,
+				"Error creating CC change work item - %!STATUS!",
+				status);
+
+			goto exit;
+		}
 
 		//
-		// Register for notifications
+		// Create the worker that powers and programs the chip with
+		// asynchronous start
 		//
-		status = RegisterForUSBCCChangeNotification(device);
+		WDF_WORKITEM_CONFIG_INIT(&workItemConfig, UtilityStartWorkItem);
+		workItemConfig.AutomaticSerialization = FALSE;
+
+		status = WdfWorkItemCreate(
+			&workItemConfig,
+			&workItemAttributes,
+			&deviceContext->StartWorkItem);
 
 		if (!NT_SUCCESS(status))
 		{
 			TraceEvents(
 				TRACE_LEVEL_ERROR,
 				TRACE_DRIVER,
-				"Error in RegisterForUSBCCChangeNotification - %!STATUS!",
+				"Error creating start work item - %!STATUS!",
 				status);
 
 			goto exit;
@@ -284,6 +939,30 @@ exit:
 	return status;
 }
 
+VOID fsa4480EvtDeviceContextCleanup(
+	_In_ WDFOBJECT Device)
+/*++
+
+Routine description:
+
+	Frees the resources allocated in fsa4480CreateDevice that are not
+	framework objects parented to the device.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	VOID
+
+--*/
+{
+	PAGED_CODE();
+
+	fsa4480BusDeinitialize((WDFDEVICE)Device);
+}
+
 _Use_decl_annotations_
 	NTSTATUS
 	fsa4480DevicePrepareHardware(
@@ -324,8 +1003,11 @@ Return Value:
 {
 	NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
 	PCM_PARTIAL_RESOURCE_DESCRIPTOR res, resRaw;
+	PCM_PARTIAL_RESOURCE_DESCRIPTOR interruptRes = NULL, interruptResRaw = NULL;
+	WDF_INTERRUPT_CONFIG interruptConfig;
 	ULONG resourceCount;
 	ULONG i;
+	LARGE_INTEGER frequency;
 
 	TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "Entering %!FUNC!\n");
 	PAGED_CODE();
@@ -334,6 +1016,9 @@ Return Value:
 
 	devContext->Device = Device;
 
+	RtlZeroMemory(&devContext->StartStatistics, sizeof(devContext->StartStatistics));
+	devContext->PrepareHardwareStartTime = KeQueryPerformanceCounter(&frequency).QuadPart;
+
 	//
 	// Get the resouce hub connection ID for our I2C driver
 	//
@@ -354,6 +1039,24 @@ Return Value:
 
 		switch (res->Type)
 		{
+		case CmResourceTypeInterrupt:
+		{
+			//
+			// CC_OUT described a second time as a GpioInt, only used in
+			// interrupt mode
+			//
+			if (interruptRes == NULL)
+			{
+				TraceEvents(
+					TRACE_LEVEL_INFORMATION,
+					TRACE_DRIVER,
+					"Found CCOUT interrupt!");
+
+				interruptRes = res;
+				interruptResRaw = resRaw;
+			}
+			break;
+		}
 		case CmResourceTypeConnection:
 		{
 			if (res->u.Connection.Class == CM_RESOURCE_CONNECTION_CLASS_SERIAL &&
@@ -468,69 +1171,266 @@ Return Value:
 
 	devContext->InitializedEnGpioHardware = TRUE;
 
-	// Enable by setting the pin LOW.
-	status = UtilitySetGPIO(devContext->EnGpio, 0);
+	status = UtilityOpenIOTarget(
+		devContext,
+		devContext->CCOutGpioId,
+		GENERIC_READ,
+		&devContext->CCOutGpio);
 
-	if (!NT_SUCCESS(status))
+	if (NT_SUCCESS(status))
+	{
+		devContext->InitializedCCOutGpioHardware = TRUE;
+	}
+	else
 	{
 		TraceEvents(
-			TRACE_LEVEL_ERROR,
+			TRACE_LEVEL_WARNING,
 			TRACE_DRIVER,
-			"Error setting enable gpio to low - %!STATUS!",
+			"Error opening CC_OUT gpio - %!STATUS!",
 			status);
-
-		goto exit;
 	}
 
-	TraceEvents(
-		TRACE_LEVEL_INFORMATION,
-		TRACE_DRIVER,
-		"Initializing FSA4480");
+	if (devContext->CCOutInterruptEnabled &&
+		devContext->InitializedCCOutGpioHardware &&
+		devContext->CCOutInterrupt == NULL)
+	{
+		if (interruptRes == NULL)
+		{
+			TraceEvents(
+				TRACE_LEVEL_WARNING,
+				TRACE_DRIVER,
+				"CC_OUT interrupt mode requested but no interrupt resource, using ACPI only");
+		}
+		else
+		{
+			//
+			// The handler does I2C and GPIO I/O synchronously, it has to
+			// run at passive level. It is connected on D0Entry.
+			//
+			WDF_INTERRUPT_CONFIG_INIT(&interruptConfig, fsa4480EvtCCOutInterruptIsr, NULL);
+			interruptConfig.PassiveHandling = TRUE;
+			interruptConfig.InterruptRaw = interruptResRaw;
+			interruptConfig.InterruptTranslated = interruptRes;
+
+			status = WdfInterruptCreate(
+				Device,
+				&interruptConfig,
+				WDF_NO_OBJECT_ATTRIBUTES,
+				&devContext->CCOutInterrupt);
+
+			if (!NT_SUCCESS(status))
+			{
+				TraceEvents(
+					TRACE_LEVEL_WARNING,
+					TRACE_DRIVER,
+					"Error creating CC_OUT interrupt, using ACPI only - %!STATUS!",
+					status);
+
+				devContext->CCOutInterrupt = NULL;
+			}
+		}
+	}
 
-	status = FSA4480_Initialize(Device);
+	//
+	// Register for notifications, fsa4480DeviceReleaseHardware unregisters.
+	// Until the chip is ready they stay pending.
+	//
+	status = RegisterForUSBCCChangeNotification(Device);
 
 	if (!NT_SUCCESS(status))
 	{
 		TraceEvents(
 			TRACE_LEVEL_ERROR,
 			TRACE_DRIVER,
-			"Error in FSA4480 initialization - %!STATUS!",
+			"Error in RegisterForUSBCCChangeNotification - %!STATUS!",
 			status);
 
 		goto exit;
 	}
 
-	devContext->InitializedFSAHardware = TRUE;
+	//
+	// Everything the chip needs is acquired. With asynchronous start the
+	// chip is powered and programmed after we return, PnP start of the
+	// stack above does not wait on the I2C traffic.
+	//
+	devContext->StartStatistics.Asynchronous = devContext->AsyncStartEnabled != 0;
+
+	if (devContext->AsyncStartEnabled)
+	{
+		WdfWorkItemEnqueue(devContext->StartWorkItem);
+		status = STATUS_SUCCESS;
+	}
+	else
+	{
+		status = UtilityStartChip(Device);
+	}
 
 exit:
+	devContext->StartStatistics.PrepareHardwareUs =
+		(ULONGLONG)(KeQueryPerformanceCounter(NULL).QuadPart - devContext->PrepareHardwareStartTime) *
+		1000000 / frequency.QuadPart;
+
 	TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "Leaving %!FUNC!: Status = 0x%08lX\n", status);
 	return status;
 }
 
-VOID fsa4480DeviceUnPrepareHardware(
-	WDFDEVICE Device)
+NTSTATUS
+fsa4480EvtDeviceD0Entry(
+	_In_ WDFDEVICE Device,
+	_In_ WDF_POWER_DEVICE_STATE PreviousState)
+/*++
+
+Routine Description:
+
+	Re-evaluates the power gate policy when the device comes back to D0,
+	the port may have been attached or detached while it was away.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+	PreviousState - Device power state the device is coming from.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
 {
 	PDEVICE_CONTEXT devContext = DeviceGetContext(Device);
-	PACPI_INTERFACE_STANDARD2 ACPIInterface;
 
-	if (devContext == NULL)
+	UNREFERENCED_PARAMETER(PreviousState);
+
+	WdfWaitLockAcquire(devContext->ChipLock, NULL);
+
+	fsa4480PowerGateUpdate(Device, FALSE);
+
+	WdfWaitLockRelease(devContext->ChipLock);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+fsa4480EvtDeviceD0Exit(
+	_In_ WDFDEVICE Device,
+	_In_ WDF_POWER_DEVICE_STATE TargetState)
+/*++
+
+Routine Description:
+
+	Stops the power gate timer and, when the device only goes to a low
+	power state, releases EN right away if nothing is attached. The final
+	power down is left to fsa4480DeviceReleaseHardware.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+	TargetState - Device power state the device is going to.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	PDEVICE_CONTEXT devContext = DeviceGetContext(Device);
+
+	PAGED_CODE();
+
+	fsa4480PowerGateStop(Device);
+
+	if (TargetState != WdfPowerDeviceD3Final)
 	{
-		return;
+		WdfWaitLockAcquire(devContext->ChipLock, NULL);
+
+		fsa4480PowerGateUpdate(Device, TRUE);
+
+		WdfWaitLockRelease(devContext->ChipLock);
 	}
 
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+fsa4480DeviceReleaseHardware(
+	WDFDEVICE Device,
+	WDFCMRESLIST ResourcesTranslated)
+/*++
+
+Routine description:
+
+	EvtDeviceReleaseHardware undoes fsa4480DevicePrepareHardware. The
+	framework calls it after the device left D0 for the last time, on
+	removal, stop and when fsa4480DevicePrepareHardware failed, so
+	everything here only tears down what was actually set up.
+
+Arguments:
+
+	Device - Supplies a handle to a framework device object.
+
+	ResourcesTranslated - Supplies a handle to a collection of framework
+		resource objects, unused.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	PDEVICE_CONTEXT devContext = DeviceGetContext(Device);
+	PACPI_INTERFACE_STANDARD2 ACPIInterface;
+
+	UNREFERENCED_PARAMETER(ResourcesTranslated);
+
+	PAGED_CODE();
+
 	if (devContext->InitializedAcpiInterface)
 	{
 		ACPIInterface = &(devContext->AcpiInterface);
 		ACPIInterface->UnregisterForDeviceNotifications(ACPIInterface->Context);
+		ACPIInterface->InterfaceDereference(ACPIInterface->Context);
 		devContext->InitializedAcpiInterface = FALSE;
 	}
 
+	if (devContext->StartWorkItem != NULL)
+	{
+		//
+		// An asynchronous start still in progress has to finish first
+		//
+		WdfWorkItemFlush(devContext->StartWorkItem);
+	}
+
+	if (devContext->CCChangeWorkItem != NULL)
+	{
+		//
+		// No more notifications can come in, let a queued switch finish
+		// before the chip is torn down
+		//
+		WdfWorkItemFlush(devContext->CCChangeWorkItem);
+	}
+
+	fsa4480PowerGateStop(Device);
+
 	if (devContext->InitializedFSAHardware)
 	{
-		FSA4480_Uninitialize(Device);
+		//
+		// A gated chip has nothing left to reset
+		//
+		if (!devContext->PowerGate.Gated)
+		{
+			FSA4480_Uninitialize(&devContext->Chip);
+		}
+
 		devContext->InitializedFSAHardware = FALSE;
 	}
 
+	if (devContext->InitializedCCOutGpioHardware)
+	{
+		WdfIoTargetClose(devContext->CCOutGpio);
+		devContext->InitializedCCOutGpioHardware = FALSE;
+	}
+
 	if (devContext->InitializedEnGpioHardware)
 	{
 		UtilitySetGPIO(devContext->EnGpio, 1);
@@ -543,4 +1443,6 @@ VOID fsa4480DeviceUnPrepareHardware(
 		SpbTargetDeinitialize(Device, &devContext->I2CContext);
 		devContext->InitializedSpbHardware = FALSE;
 	}
+
+	return STATUS_SUCCESS;
 }
\ No newline at end of file
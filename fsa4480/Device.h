@@ -18,6 +18,17 @@ Environment:
 
 #include "spb.h"
 #include "fsa4480.h"
+#include "bus.h"
+#include "power.h"
+#include "interface.h"
+
+//
+// CC_OUT values reported through the ACPI notification
+//
+#define CC_OUT_CC1 0
+#define CC_OUT_CC2 1
+#define CC_OUT_OPEN 2
+#define CC_OUT_NONE ((LONG)-1)
 
 //
 // The device context performs the same job as
@@ -32,6 +43,7 @@ typedef struct _DEVICE_CONTEXT
 
 	BOOLEAN InitializedSpbHardware;
 	BOOLEAN InitializedEnGpioHardware;
+	BOOLEAN InitializedCCOutGpioHardware;
 	BOOLEAN InitializedAcpiInterface;
 	BOOLEAN InitializedFSAHardware;
 
@@ -43,13 +55,82 @@ typedef struct _DEVICE_CONTEXT
 	LARGE_INTEGER CCOutGpioId;
 	WDFIOTARGET CCOutGpio;
 
+	//
+	// Optional CC_OUT edge interrupt, enabled by the CCOutInterrupt value of
+	// the device hardware key when firmware also describes CC_OUT as a
+	// GpioInt. LastEdgeCCOUT and LastEdgeTime hold the last orientation it
+	// applied, to measure the ACPI notification lag against, until the
+	// next notification. LastAcpiTime is the arrival time of that one.
+	//
+	ULONG CCOutInterruptEnabled;
+	WDFINTERRUPT CCOutInterrupt;
+	volatile LONG LastEdgeCCOUT;
+	volatile LONGLONG LastEdgeTime;
+	volatile LONGLONG LastAcpiTime;
+
 	LARGE_INTEGER EnGpioId;
 	WDFIOTARGET EnGpio;
 
 	ACPI_INTERFACE_STANDARD2 AcpiInterface;
 
+	//
+	// Last CC_OUT value applied, only valid under ChipLock. Code not
+	// holding it reads the orientation from FSA4480_ReadState.
+	//
 	ULONG CCOUT;
-	USBC_PARTNER USBCPartner;
+
+	//
+	// FSA4480 chip logic state, its bus is bound to I2CContext and the
+	// delay timer below by fsa4480BusInitialize
+	//
+	FSA4480_CHIP Chip;
+	FSA4480_DELAY_STRATEGY DelayStrategy;
+	PEX_TIMER DelayTimer;
+
+	//
+	// Serializes everything that touches the chip or EN: the CC change
+	// worker, the power gate timer and the power callbacks
+	//
+	WDFWAITLOCK ChipLock;
+
+	//
+	// EN power gating, see power.c
+	//
+	POWER_GATE_CONTEXT PowerGate;
+
+	//
+	// CC change notifications are only recorded by the ACPI callback and
+	// applied by CCChangeWorkItem. PendingCCOUT holds the latest value not
+	// yet applied (CC_OUT_NONE if there is none), so intermediate values of
+	// a notification burst are dropped.
+	//
+	WDFWORKITEM CCChangeWorkItem;
+	volatile LONG PendingCCOUT;
+	volatile LONG PendingSource;
+	volatile LONG CCNotificationsReceived;
+	volatile LONG CCNotificationsCoalesced;
+	volatile LONG CCNotificationsApplied;
+
+	//
+	// Arrival time of the CC notification behind PendingCCOUT, the start of
+	// the switch latency measurement. PendingSource tells which path it
+	// came through.
+	//
+	volatile LONGLONG PendingNotifyTime;
+
+	//
+	// With AsyncStart set in the device hardware key, the chip is powered
+	// and programmed by StartWorkItem after fsa4480DevicePrepareHardware
+	// has returned
+	//
+	ULONG AsyncStartEnabled;
+	WDFWORKITEM StartWorkItem;
+
+	//
+	// Bus cost and duration of the last start
+	//
+	LONGLONG PrepareHardwareStartTime;
+	FSA4480_START_STATISTICS StartStatistics;
 } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
 //
@@ -59,6 +140,21 @@ typedef struct _DEVICE_CONTEXT
 //
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, DeviceGetContext)
 
+NTSTATUS UtilitySetGPIO(
+	WDFIOTARGET GpioIoTarget,
+	UCHAR Value);
+
+NTSTATUS UtilityQueryDeviceULong(
+	WDFDEVICE Device,
+	PCUNICODE_STRING ValueName,
+	PULONG Value);
+
+VOID UtilityQueryProfiles(
+	WDFDEVICE Device);
+
+NTSTATUS UtilityStartChip(
+	WDFDEVICE Device);
+
 //
 // Function to initialize the device and its callbacks
 //
@@ -17,6 +17,14 @@ Environment:
 #include "driver.h"
 #include "driver.tmh"
 
+//
+// {0c2b4b3e-7a8f-4d6c-9e4b-5a1f3d2c6b70}
+//
+TRACELOGGING_DEFINE_PROVIDER(
+	gFsa4480EventProvider,
+	"Fsa4480",
+	(0x0c2b4b3e, 0x7a8f, 0x4d6c, 0x9e, 0x4b, 0x5a, 0x1f, 0x3d, 0x2c, 0x6b, 0x70));
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(INIT, DriverEntry)
 #pragma alloc_text(PAGE, fsa4480EvtDeviceAdd)
@@ -63,6 +71,16 @@ Return Value:
 	//
 	WPP_INIT_TRACING(DriverObject, RegistryPath);
 
+	//
+	// The driver works without its events, a failure only leaves them off
+	//
+	status = TraceLoggingRegister(gFsa4480EventProvider);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(TRACE_LEVEL_WARNING, TRACE_DRIVER, "TraceLoggingRegister failed %!STATUS!", status);
+	}
+
 	TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC! Entry");
 
 	//
@@ -85,6 +103,7 @@ Return Value:
 	if (!NT_SUCCESS(status))
 	{
 		TraceEvents(TRACE_LEVEL_ERROR, TRACE_DRIVER, "WdfDriverCreate failed %!STATUS!", status);
+		TraceLoggingUnregister(gFsa4480EventProvider);
 		WPP_CLEANUP(DriverObject);
 		return status;
 	}
@@ -151,9 +170,11 @@ Return Value:
 {
 	PAGED_CODE();
 
+	UNREFERENCED_PARAMETER(DriverObject);
+
 	TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC! Entry");
 
-	fsa4480DeviceUnPrepareHardware((WDFDEVICE)DriverObject);
+	TraceLoggingUnregister(gFsa4480EventProvider);
 
 	//
 	// Stop WPP Tracing
@@ -180,6 +201,8 @@ Return Value:
 {
 	PAGED_CODE();
 
+	TraceLoggingUnregister(gFsa4480EventProvider);
+
 	//
 	// Stop WPP Tracing
 	//
@@ -21,7 +21,9 @@ Environment:
 #include <initguid.h>
 
 #include "device.h"
+#include "queue.h"
 #include "trace.h"
+#include "events.h"
 
 //
 // WDFDRIVER Events
@@ -31,7 +33,9 @@ DRIVER_INITIALIZE DriverEntry;
 EVT_WDF_DRIVER_DEVICE_ADD fsa4480EvtDeviceAdd;
 EVT_WDF_OBJECT_CONTEXT_CLEANUP fsa4480EvtDriverContextCleanup;
 EVT_WDF_DEVICE_PREPARE_HARDWARE fsa4480DevicePrepareHardware;
-EVT_WDF_DRIVER_UNLOAD fsa4480EvtDriverUnload;
-
-VOID fsa4480DeviceUnPrepareHardware(
-	WDFDEVICE Device);
\ No newline at end of file
+EVT_WDF_DEVICE_RELEASE_HARDWARE fsa4480DeviceReleaseHardware;
+EVT_WDF_DEVICE_D0_ENTRY fsa4480EvtDeviceD0Entry;
+EVT_WDF_DEVICE_D0_EXIT fsa4480EvtDeviceD0Exit;
+EVT_WDF_INTERRUPT_ISR fsa4480EvtCCOutInterruptIsr;
+EVT_WDF_OBJECT_CONTEXT_CLEANUP fsa4480EvtDeviceContextCleanup;
+EVT_WDF_DRIVER_UNLOAD fsa4480EvtDriverUnload;
\ No newline at end of file
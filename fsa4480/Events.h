@@ -0,0 +1,119 @@
+/*++
+
+Module Name:
+
+	events.h
+
+Abstract:
+
+	TraceLogging events of the switch hot path. Unlike the WPP messages
+	in trace.h these carry typed fields, register values and durations,
+	so WPR/WPA can chart switch timelines without decoding strings.
+
+	Provider "Fsa4480" {0c2b4b3e-7a8f-4d6c-9e4b-5a1f3d2c6b70}, e.g.
+
+	  xperf -start fsa -on 0c2b4b3e-7a8f-4d6c-9e4b-5a1f3d2c6b70:0xF:5 -f fsa.etl
+
+	Every event is filtered on its keyword before any field is evaluated
+	and durations are only measured while a session asks for them, with
+	no session listening the hot path pays a load and a test per event.
+
+Environment:
+
+	Kernel mode
+
+--*/
+
+#pragma once
+
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DECLARE_PROVIDER(gFsa4480EventProvider);
+
+//
+// Keywords, one per event kind
+//
+#define FSA4480_EVENT_KEYWORD_TRANSITION 0x1
+#define FSA4480_EVENT_KEYWORD_REGISTER 0x2
+#define FSA4480_EVENT_KEYWORD_STATUS 0x4
+#define FSA4480_EVENT_KEYWORD_DELAY 0x8
+
+#define FSA4480_EVENTS_ENABLED(Keyword) \
+	TraceLoggingProviderEnabled(gFsa4480EventProvider, WINEVENT_LEVEL_VERBOSE, (Keyword))
+
+//
+// A switch between two FSA4480_STATE values, Begin and End bracket it
+// (start/stop opcodes) so WPA shows it as a region. ElapsedTicks are
+// FSA4480_BUS time ticks.
+//
+#define FSA4480_EVENT_TRANSITION_BEGIN(From, To, StepCount, Batched) \
+	TraceLoggingWrite(                                                  \
+		gFsa4480EventProvider,                                          \
+		"TransitionBegin",                                              \
+		TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                      \
+		TraceLoggingKeyword(FSA4480_EVENT_KEYWORD_TRANSITION),          \
+		TraceLoggingOpcode(WINEVENT_OPCODE_START),                      \
+		TraceLoggingUInt32((ULONG)(From), "From"),                      \
+		TraceLoggingUInt32((ULONG)(To), "To"),                          \
+		TraceLoggingUInt32((ULONG)(StepCount), "StepCount"),            \
+		TraceLoggingBoolean((Batched), "Batched"))
+
+#define FSA4480_EVENT_TRANSITION_END(From, To, Status, ElapsedTicks) \
+	TraceLoggingWrite(                                                  \
+		gFsa4480EventProvider,                                          \
+		"TransitionEnd",                                                \
+		TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                      \
+		TraceLoggingKeyword(FSA4480_EVENT_KEYWORD_TRANSITION),          \
+		TraceLoggingOpcode(WINEVENT_OPCODE_STOP),                       \
+		TraceLoggingUInt32((ULONG)(From), "From"),                      \
+		TraceLoggingUInt32((ULONG)(To), "To"),                          \
+		TraceLoggingNTStatus((Status), "Status"),                       \
+		TraceLoggingInt64((ElapsedTicks), "ElapsedTicks"))
+
+//
+// Register writes that went out on the bus, writes the cache absorbed
+// leave no event. A batched write carries the status and duration of the
+// whole batch.
+//
+#define FSA4480_EVENT_REGISTER_WRITE(Address, Values, Count, Batched, Status, ElapsedTicks) \
+	TraceLoggingWrite(                                                                         \
+		gFsa4480EventProvider,                                                                 \
+		"RegisterWrite",                                                                       \
+		TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                                             \
+		TraceLoggingKeyword(FSA4480_EVENT_KEYWORD_REGISTER),                                   \
+		TraceLoggingUInt8((UCHAR)(Address), "Address"),                                        \
+		TraceLoggingUInt8Array((Values), (USHORT)(Count), "Values"),                           \
+		TraceLoggingBoolean((Batched), "Batched"),                                             \
+		TraceLoggingNTStatus((Status), "Status"),                                              \
+		TraceLoggingInt64((ElapsedTicks), "ElapsedTicks"))
+
+//
+// Register reads that went out on the bus, in practice the volatile
+// switch status registers
+//
+#define FSA4480_EVENT_STATUS_READ(Address, Value, Batched, Status, ElapsedTicks) \
+	TraceLoggingWrite(                                                              \
+		gFsa4480EventProvider,                                                      \
+		"StatusRead",                                                               \
+		TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                                  \
+		TraceLoggingKeyword(FSA4480_EVENT_KEYWORD_STATUS),                          \
+		TraceLoggingUInt8((UCHAR)(Address), "Address"),                             \
+		TraceLoggingHexUInt8((UCHAR)(Value), "Value"),                              \
+		TraceLoggingBoolean((Batched), "Batched"),                                  \
+		TraceLoggingNTStatus((Status), "Status"),                                   \
+		TraceLoggingInt64((ElapsedTicks), "ElapsedTicks"))
+
+//
+// Settle delays. A batched one is waited out by the controller and
+// carries the duration of the whole batch.
+//
+#define FSA4480_EVENT_DELAY(RequestedUs, Batched, Status, ElapsedTicks) \
+	TraceLoggingWrite(                                                  \
+		gFsa4480EventProvider,                                          \
+		"Delay",                                                        \
+		TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                      \
+		TraceLoggingKeyword(FSA4480_EVENT_KEYWORD_DELAY),               \
+		TraceLoggingUInt32((ULONG)(RequestedUs), "RequestedUs"),         \
+		TraceLoggingBoolean((Batched), "Batched"),                      \
+		TraceLoggingNTStatus((Status), "Status"),                       \
+		TraceLoggingInt64((ElapsedTicks), "ElapsedTicks"))
\ No newline at end of file
@@ -0,0 +1,281 @@
+/*++
+
+Module Name:
+
+	interface.c
+
+Abstract:
+
+	This file implements FSA4480_INTERFACE_STANDARD. Partner changes and
+	MIC/GND swaps are applied under DEVICE_CONTEXT::ChipLock like CC
+	changes, state queries only read the published state snapshot.
+
+Environment:
+
+	Kernel-mode Driver Framework
+
+--*/
+
+#include "driver.h"
+#include "interface.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, fsa4480InterfaceInitialize)
+#pragma alloc_text(PAGE, fsa4480InterfaceSetPartner)
+#pragma alloc_text(PAGE, fsa4480InterfaceSwapMicGnd)
+#endif
+
+NTSTATUS
+fsa4480InterfaceSetPartner(
+	_In_ PVOID Context,
+	_In_ ULONG Partner,
+	_Out_opt_ PULONG Generation)
+/*++
+
+Routine Description:
+
+	FSA4480_INTERFACE_STANDARD SetPartner, switches the mux for the
+	reported USB-C partner.
+
+Arguments:
+
+	Context - Handle to the framework device object.
+
+	Partner - USBC_PARTNER value.
+
+	Generation - Receives the generation of the resulting state.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	NTSTATUS status;
+	WDFDEVICE device = (WDFDEVICE)Context;
+	PDEVICE_CONTEXT deviceContext = DeviceGetContext(device);
+	FSA4480_STATE_SNAPSHOT snapshot;
+
+	PAGED_CODE();
+
+	if (Partner > UsbCPartnerDebugAccessory)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	WdfWaitLockAcquire(deviceContext->ChipLock, NULL);
+
+	if (!deviceContext->InitializedFSAHardware)
+	{
+		status = STATUS_DEVICE_NOT_READY;
+		goto exit;
+	}
+
+	//
+	// An audio accessory keeps the chip powered, EN has to be asserted
+	// before the switch. Other partners are left to the gating policy
+	// below once the switch is done.
+	//
+	if (Partner == UsbCPartnerAudioAccessory)
+	{
+		WdfTimerStop(deviceContext->PowerGate.Timer, FALSE);
+
+		status = fsa4480PowerGateRelease(device);
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+	}
+
+	status = FSA4480_OnUSBCModeChanged(
+		&deviceContext->Chip,
+		(USBC_PARTNER)Partner);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error switching for USB-C partner %d - %!STATUS!",
+			Partner,
+			status);
+	}
+
+	fsa4480PowerGateUpdate(device, FALSE);
+
+exit:
+	if (Generation != NULL)
+	{
+		*Generation = fsa4480InterfaceQueryState(Context, &snapshot);
+	}
+
+	WdfWaitLockRelease(deviceContext->ChipLock);
+
+	return status;
+}
+
+NTSTATUS
+fsa4480InterfaceSwapMicGnd(
+	_In_ PVOID Context,
+	_Out_opt_ PULONG Generation)
+/*++
+
+Routine Description:
+
+	FSA4480_INTERFACE_STANDARD SwapMicGnd, toggles the MIC and GND
+	routing of an attached audio accessory.
+
+Arguments:
+
+	Context - Handle to the framework device object.
+
+	Generation - Receives the generation of the resulting state.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	NTSTATUS status;
+	WDFDEVICE device = (WDFDEVICE)Context;
+	PDEVICE_CONTEXT deviceContext = DeviceGetContext(device);
+	FSA4480_STATE_SNAPSHOT snapshot;
+
+	PAGED_CODE();
+
+	WdfWaitLockAcquire(deviceContext->ChipLock, NULL);
+
+	if (!deviceContext->InitializedFSAHardware)
+	{
+		status = STATUS_DEVICE_NOT_READY;
+		goto exit;
+	}
+
+	//
+	// Without an audio accessory the swap would route audio over a port
+	// carrying USB or DisplayPort
+	//
+	if (deviceContext->Chip.USBCPartner != UsbCPartnerAudioAccessory)
+	{
+		status = STATUS_INVALID_DEVICE_STATE;
+		goto exit;
+	}
+
+	FSA4480_BeginSwitchTiming(
+		&deviceContext->Chip,
+		FSA4480_LATENCY_SOURCE_COUNT,
+		0);
+
+	status = FSA4480_Switch(&deviceContext->Chip, FSA4480_SWAP_MIC_GND);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error swapping MIC and GND - %!STATUS!",
+			status);
+	}
+
+exit:
+	if (Generation != NULL)
+	{
+		*Generation = fsa4480InterfaceQueryState(Context, &snapshot);
+	}
+
+	WdfWaitLockRelease(deviceContext->ChipLock);
+
+	return status;
+}
+
+ULONG
+fsa4480InterfaceQueryState(
+	_In_ PVOID Context,
+	_Out_ PFSA4480_STATE_SNAPSHOT Snapshot)
+/*++
+
+Routine Description:
+
+	FSA4480_INTERFACE_STANDARD QueryState, copies the published state
+	snapshot without waiting for a switch in progress.
+
+Arguments:
+
+	Context - Handle to the framework device object.
+
+	Snapshot - Receives the state snapshot.
+
+Return Value:
+
+	Generation of the snapshot
+
+--*/
+{
+	FSA4480_ReadState(
+		&DeviceGetContext((WDFDEVICE)Context)->Chip,
+		Snapshot);
+
+	return Snapshot->Generation;
+}
+
+NTSTATUS
+fsa4480InterfaceInitialize(
+	_In_ WDFDEVICE Device)
+/*++
+
+Routine Description:
+
+	Registers FSA4480_INTERFACE_STANDARD with the framework, which then
+	answers IRP_MN_QUERY_INTERFACE for it.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	NTSTATUS status;
+	FSA4480_INTERFACE_STANDARD fsa4480Interface;
+	WDF_QUERY_INTERFACE_CONFIG queryInterfaceConfig;
+
+	PAGED_CODE();
+
+	RtlZeroMemory(&fsa4480Interface, sizeof(fsa4480Interface));
+
+	fsa4480Interface.InterfaceHeader.Size = sizeof(fsa4480Interface);
+	fsa4480Interface.InterfaceHeader.Version = FSA4480_INTERFACE_STANDARD_VERSION;
+	fsa4480Interface.InterfaceHeader.Context = (PVOID)Device;
+	fsa4480Interface.InterfaceHeader.InterfaceReference = WdfDeviceInterfaceReferenceNoOp;
+	fsa4480Interface.InterfaceHeader.InterfaceDereference = WdfDeviceInterfaceDereferenceNoOp;
+	fsa4480Interface.SetPartner = fsa4480InterfaceSetPartner;
+	fsa4480Interface.SwapMicGnd = fsa4480InterfaceSwapMicGnd;
+	fsa4480Interface.QueryState = fsa4480InterfaceQueryState;
+
+	//
+	// The framework copies the interface into every query, nothing here
+	// has to outlive this call
+	//
+	WDF_QUERY_INTERFACE_CONFIG_INIT(
+		&queryInterfaceConfig,
+		(PINTERFACE)&fsa4480Interface,
+		&GUID_FSA4480_INTERFACE_STANDARD,
+		NULL);
+
+	status = WdfDeviceAddQueryInterface(Device, &queryInterfaceConfig);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error adding query interface - %!STATUS!",
+			status);
+	}
+
+	return status;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*++
+
+Module Name:
+
+	interface.h
+
+Abstract:
+
+	This file contains the direct-call interface the device exposes to
+	other kernel mode drivers through IRP_MN_QUERY_INTERFACE, for UCM and
+	audio clients that drive the mux without going through IOCTLs.
+
+Environment:
+
+	Kernel-mode Driver Framework
+
+--*/
+
+#pragma once
+
+#include "public.h"
+
+DEFINE_GUID(GUID_FSA4480_INTERFACE_STANDARD,
+	0xaa99f569, 0x3fb6, 0x4ac1, 0x93, 0xeb, 0xe7, 0xc9, 0x0e, 0x90, 0x06, 0x07);
+// {aa99f569-3fb6-4ac1-93eb-e7c90e900607}
+
+#define FSA4480_INTERFACE_STANDARD_VERSION 1
+
+//
+// SetPartner reports the USB-C partner (a USBC_PARTNER value) and switches
+// the mux for it. SwapMicGnd swaps the MIC and GND routing of an attached
+// audio accessory. Both must be called at PASSIVE_LEVEL, they wait for
+// any switch in progress and return in Generation the generation of the
+// FSA4480_STATE_SNAPSHOT they left behind.
+//
+// QueryState can be called at any IRQL, it never blocks and returns the
+// generation of the snapshot it copied.
+//
+// The interface uses no reference counting, it must not be called once
+// the client was notified of the removal of the FSA4480 device.
+//
+typedef NTSTATUS
+FSA4480_INTERFACE_SET_PARTNER(
+	_In_ PVOID Context,
+	_In_ ULONG Partner,
+	_Out_opt_ PULONG Generation);
+
+typedef NTSTATUS
+FSA4480_INTERFACE_SWAP_MIC_GND(
+	_In_ PVOID Context,
+	_Out_opt_ PULONG Generation);
+
+typedef ULONG
+FSA4480_INTERFACE_QUERY_STATE(
+	_In_ PVOID Context,
+	_Out_ PFSA4480_STATE_SNAPSHOT Snapshot);
+
+typedef struct _FSA4480_INTERFACE_STANDARD
+{
+	INTERFACE InterfaceHeader;
+	FSA4480_INTERFACE_SET_PARTNER *SetPartner;
+	FSA4480_INTERFACE_SWAP_MIC_GND *SwapMicGnd;
+	FSA4480_INTERFACE_QUERY_STATE *QueryState;
+} FSA4480_INTERFACE_STANDARD, *PFSA4480_INTERFACE_STANDARD;
+
+NTSTATUS
+fsa4480InterfaceInitialize(
+	_In_ WDFDEVICE Device);
+
+//
+// FSA4480_INTERFACE_STANDARD entry points
+//
+FSA4480_INTERFACE_SET_PARTNER fsa4480InterfaceSetPartner;
+FSA4480_INTERFACE_SWAP_MIC_GND fsa4480InterfaceSwapMicGnd;
+FSA4480_INTERFACE_QUERY_STATE fsa4480InterfaceQueryState;
\ No newline at end of file
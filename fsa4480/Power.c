@@ -0,0 +1,404 @@
+/*++
+
+Module Name:
+
+	power.c
+
+Abstract:
+
+	This file implements the EN power gating policy. The FSA4480 is only
+	needed while something is attached to the port, EN is released once
+	CC_OUT has reported open for the hysteresis time and no audio accessory
+	is present, and asserted again before the next switch.
+
+	Except for the timer callback and fsa4480PowerGateGetStatistics, the
+	routines here expect the caller to hold DEVICE_CONTEXT::ChipLock.
+
+Environment:
+
+	Kernel-mode Driver Framework
+
+--*/
+
+#include "driver.h"
+#include "power.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, fsa4480PowerGateInitialize)
+#pragma alloc_text(PAGE, fsa4480PowerGateStop)
+#endif
+
+BOOLEAN
+fsa4480PowerGateIsIdle(
+	PDEVICE_CONTEXT DeviceContext)
+{
+	return DeviceContext->CCOUT == CC_OUT_OPEN &&
+		   DeviceContext->Chip.USBCPartner != UsbCPartnerAudioAccessory;
+}
+
+NTSTATUS
+fsa4480PowerGateApply(
+	PDEVICE_CONTEXT DeviceContext)
+{
+	NTSTATUS status;
+	PPOWER_GATE_CONTEXT powerGate = &DeviceContext->PowerGate;
+
+	//
+	// Whether or not EN makes it, the chip state is not trusted anymore
+	//
+	FSA4480_PowerDown(&DeviceContext->Chip);
+
+	status = UtilitySetGPIO(DeviceContext->EnGpio, 1);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error setting enable gpio to high - %!STATUS!",
+			status);
+
+		goto exit;
+	}
+
+	powerGate->Gated = TRUE;
+	powerGate->GatedSince = KeQueryPerformanceCounter(NULL).QuadPart;
+	powerGate->GateCount++;
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"FSA4480 power gated (%d times)",
+		powerGate->GateCount);
+
+exit:
+	return status;
+}
+
+NTSTATUS
+fsa4480PowerGateInitialize(
+	_In_ WDFDEVICE Device)
+/*++
+
+Routine Description:
+
+	Reads the hysteresis from the device hardware key and creates the
+	timer releasing EN once it has elapsed.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	NTSTATUS status;
+	PDEVICE_CONTEXT deviceContext;
+	WDF_TIMER_CONFIG timerConfig;
+	WDF_OBJECT_ATTRIBUTES timerAttributes;
+	DECLARE_CONST_UNICODE_STRING(hysteresisValueName, L"PowerGateHysteresisMs");
+
+	PAGED_CODE();
+
+	deviceContext = DeviceGetContext(Device);
+	deviceContext->PowerGate.HysteresisMs = FSA4480_POWER_GATE_HYSTERESIS_MS;
+
+	UtilityQueryDeviceULong(
+		Device,
+		&hysteresisValueName,
+		&deviceContext->PowerGate.HysteresisMs);
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Power gate hysteresis %d ms",
+		deviceContext->PowerGate.HysteresisMs);
+
+	//
+	// The timer callback talks to the GPIO and I2C targets synchronously
+	//
+	WDF_TIMER_CONFIG_INIT(&timerConfig, fsa4480EvtPowerGateTimer);
+	timerConfig.AutomaticSerialization = FALSE;
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+	timerAttributes.ParentObject = Device;
+	timerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+	status = WdfTimerCreate(
+		&timerConfig,
+		&timerAttributes,
+		&deviceContext->PowerGate.Timer);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error creating power gate timer - %!STATUS!",
+			status);
+	}
+
+	return status;
+}
+
+VOID
+fsa4480PowerGateStart(
+	_In_ WDFDEVICE Device)
+/*++
+
+Routine Description:
+
+	Resets the gating statistics once the chip has been initialized.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	None
+
+--*/
+{
+	PPOWER_GATE_CONTEXT powerGate = &DeviceGetContext(Device)->PowerGate;
+
+	powerGate->Gated = FALSE;
+	powerGate->GateCount = 0;
+	powerGate->GatedTime = 0;
+	powerGate->StartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+VOID
+fsa4480PowerGateStop(
+	_In_ WDFDEVICE Device)
+/*++
+
+Routine Description:
+
+	Cancels a pending hysteresis timer and waits for a running callback.
+	Must be called without ChipLock held.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	None
+
+--*/
+{
+	PDEVICE_CONTEXT deviceContext = DeviceGetContext(Device);
+
+	PAGED_CODE();
+
+	if (deviceContext->PowerGate.Timer != NULL)
+	{
+		WdfTimerStop(deviceContext->PowerGate.Timer, TRUE);
+	}
+}
+
+NTSTATUS
+fsa4480PowerGateRelease(
+	_In_ WDFDEVICE Device)
+/*++
+
+Routine Description:
+
+	Asserts EN again if it was released and restores the default
+	registers. The switches are left to the next transition, which starts
+	from scratch.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	PDEVICE_CONTEXT deviceContext = DeviceGetContext(Device);
+	PPOWER_GATE_CONTEXT powerGate = &deviceContext->PowerGate;
+
+	if (!powerGate->Gated)
+	{
+		goto exit;
+	}
+
+	// Enable by setting the pin LOW.
+	status = UtilitySetGPIO(deviceContext->EnGpio, 0);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error setting enable gpio to low - %!STATUS!",
+			status);
+
+		goto exit;
+	}
+
+	powerGate->Gated = FALSE;
+	powerGate->GatedTime += KeQueryPerformanceCounter(NULL).QuadPart - powerGate->GatedSince;
+
+	status = FSA4480_PowerUp(&deviceContext->Chip);
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"FSA4480 power gate released - %!STATUS!",
+		status);
+
+exit:
+	return status;
+}
+
+VOID
+fsa4480PowerGateUpdate(
+	_In_ WDFDEVICE Device,
+	_In_ BOOLEAN Immediate)
+/*++
+
+Routine Description:
+
+	Applies the gating policy to the current CC_OUT and partner: releases
+	EN when the port is in use, otherwise arms the hysteresis timer or,
+	with Immediate, gates right away.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+	Immediate - Skip the hysteresis.
+
+Return Value:
+
+	None
+
+--*/
+{
+	PDEVICE_CONTEXT deviceContext = DeviceGetContext(Device);
+	PPOWER_GATE_CONTEXT powerGate = &deviceContext->PowerGate;
+
+	if (!deviceContext->InitializedFSAHardware ||
+		!deviceContext->InitializedEnGpioHardware)
+	{
+		return;
+	}
+
+	if (!fsa4480PowerGateIsIdle(deviceContext) ||
+		powerGate->HysteresisMs == FSA4480_POWER_GATE_DISABLED)
+	{
+		WdfTimerStop(powerGate->Timer, FALSE);
+		fsa4480PowerGateRelease(Device);
+		return;
+	}
+
+	if (powerGate->Gated)
+	{
+		return;
+	}
+
+	if (Immediate || powerGate->HysteresisMs == 0)
+	{
+		fsa4480PowerGateApply(deviceContext);
+	}
+	else
+	{
+		WdfTimerStart(
+			powerGate->Timer,
+			WDF_REL_TIMEOUT_IN_MS(powerGate->HysteresisMs));
+	}
+}
+
+VOID
+fsa4480EvtPowerGateTimer(
+	_In_ WDFTIMER Timer)
+/*++
+
+Routine Description:
+
+	The port stayed idle for the whole hysteresis, release EN unless a CC
+	change came in meanwhile.
+
+Arguments:
+
+	Timer - Handle to the power gate timer.
+
+Return Value:
+
+	None
+
+--*/
+{
+	WDFDEVICE device = (WDFDEVICE)WdfTimerGetParentObject(Timer);
+	PDEVICE_CONTEXT deviceContext = DeviceGetContext(device);
+
+	WdfWaitLockAcquire(deviceContext->ChipLock, NULL);
+
+	fsa4480PowerGateUpdate(device, TRUE);
+
+	WdfWaitLockRelease(deviceContext->ChipLock);
+}
+
+VOID
+fsa4480PowerGateGetStatistics(
+	_In_ WDFDEVICE Device,
+	_Out_ PFSA4480_POWER_STATISTICS Statistics)
+/*++
+
+Routine Description:
+
+	Returns the gating statistics for IOCTL_FSA4480_GET_POWER_STATISTICS.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+	Statistics - Receives the statistics.
+
+Return Value:
+
+	None
+
+--*/
+{
+	PDEVICE_CONTEXT deviceContext = DeviceGetContext(Device);
+	PPOWER_GATE_CONTEXT powerGate = &deviceContext->PowerGate;
+	LONGLONG now;
+	LONGLONG gatedTime;
+	LONGLONG frequency = deviceContext->Chip.Bus.TimeFrequency;
+
+	RtlZeroMemory(Statistics, sizeof(FSA4480_POWER_STATISTICS));
+
+	WdfWaitLockAcquire(deviceContext->ChipLock, NULL);
+
+	now = KeQueryPerformanceCounter(NULL).QuadPart;
+	gatedTime = powerGate->GatedTime;
+
+	if (powerGate->Gated)
+	{
+		gatedTime += now - powerGate->GatedSince;
+	}
+
+	Statistics->Version = FSA4480_POWER_VERSION;
+	Statistics->Gated = powerGate->Gated;
+	Statistics->HysteresisMs = powerGate->HysteresisMs;
+	Statistics->GateCount = powerGate->GateCount;
+
+	if (powerGate->StartTime != 0)
+	{
+		Statistics->GatedTimeUs = (ULONGLONG)gatedTime * 1000000 / frequency;
+		Statistics->PoweredTimeUs =
+			(ULONGLONG)(now - powerGate->StartTime - gatedTime) * 1000000 / frequency;
+	}
+
+	WdfWaitLockRelease(deviceContext->ChipLock);
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+/*++
+
+Module Name:
+
+	power.h
+
+Abstract:
+
+	This file contains the definitions of the EN power gating policy.
+
+Environment:
+
+	Kernel-mode Driver Framework
+
+--*/
+
+#pragma once
+
+//
+// Time the port has to stay idle before EN is released, overridden by the
+// PowerGateHysteresisMs value of the device hardware key. A value of
+// FSA4480_POWER_GATE_DISABLED keeps the chip powered at all times.
+//
+#define FSA4480_POWER_GATE_HYSTERESIS_MS 2000
+#define FSA4480_POWER_GATE_DISABLED 0xFFFFFFFF
+
+typedef struct _POWER_GATE_CONTEXT
+{
+	WDFTIMER Timer;
+	ULONG HysteresisMs;
+
+	//
+	// TRUE while EN is released. Updated with DEVICE_CONTEXT::ChipLock held.
+	//
+	BOOLEAN Gated;
+	ULONG GateCount;
+
+	//
+	// Performance counter timestamps: start of the device, start of the
+	// gated period in progress and total of the completed gated periods
+	//
+	LONGLONG StartTime;
+	LONGLONG GatedSince;
+	LONGLONG GatedTime;
+} POWER_GATE_CONTEXT, *PPOWER_GATE_CONTEXT;
+
+NTSTATUS
+fsa4480PowerGateInitialize(
+	_In_ WDFDEVICE Device);
+
+VOID
+fsa4480PowerGateStart(
+	_In_ WDFDEVICE Device);
+
+VOID
+fsa4480PowerGateStop(
+	_In_ WDFDEVICE Device);
+
+NTSTATUS
+fsa4480PowerGateRelease(
+	_In_ WDFDEVICE Device);
+
+VOID
+fsa4480PowerGateUpdate(
+	_In_ WDFDEVICE Device,
+	_In_ BOOLEAN Immediate);
+
+VOID
+fsa4480PowerGateGetStatistics(
+	_In_ WDFDEVICE Device,
+	_Out_ PFSA4480_POWER_STATISTICS Statistics);
+
+EVT_WDF_TIMER fsa4480EvtPowerGateTimer;
\ No newline at end of file
@@ -0,0 +1,342 @@
+/*++
+
+Module Name:
+
+	public.h
+
+Abstract:
+
+	This module contains the common declarations shared by driver
+	and user applications.
+
+Environment:
+
+	user and kernel
+
+--*/
+
+#pragma once
+
+//
+// Define an Interface Guid so that apps can find the device and talk to it.
+//
+
+DEFINE_GUID(GUID_DEVINTERFACE_fsa4480,
+	0x8257d1f0, 0x4112, 0x4168, 0xb9, 0x91, 0xe9, 0xef, 0x47, 0xb4, 0x5c, 0xe7);
+// {8257d1f0-4112-4168-b991-e9ef47b45ce7}
+
+//
+// Returns an FSA4480_SWITCH_LATENCY structure
+//
+#define IOCTL_FSA4480_GET_SWITCH_LATENCY \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Returns an FSA4480_POWER_STATISTICS structure
+//
+#define IOCTL_FSA4480_GET_POWER_STATISTICS \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Returns an FSA4480_START_STATISTICS structure
+//
+#define IOCTL_FSA4480_GET_START_STATISTICS \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Returns an FSA4480_BUS_STATISTICS structure
+//
+#define IOCTL_FSA4480_GET_BUS_STATISTICS \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x803, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Returns an FSA4480_STATE_SNAPSHOT structure
+//
+#define IOCTL_FSA4480_GET_STATE \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Returns an FSA4480_SPB_TRACE structure
+//
+#define IOCTL_FSA4480_GET_SPB_TRACE \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Returns an FSA4480_REGISTER_DUMP structure
+//
+#define IOCTL_FSA4480_GET_REGISTER_DUMP \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Switch latency histograms
+//
+// Every switch is timestamped from the moment its trigger (CC change
+// notification or partner change) is received. Each stage is measured from
+// that point:
+//
+// PROGRAMMED - SWITCH_CONTROL holds the new configuration
+// SETTLED    - the settle delay has elapsed
+// COMPLETE   - switches are enabled and, for DisplayPort, status validated
+//
+// Bucket 0 counts samples below 1 us, bucket i counts samples in
+// [2^(i-1), 2^i) us and the last bucket also counts everything above.
+//
+// Sources holds the same stages per CC change source, ACPI notification or
+// CC_OUT GPIO interrupt, for CC changes only. AcpiLag is the time from a
+// CC_OUT edge to the ACPI notification reporting the same orientation,
+// it is only collected while both sources are active.
+//
+// MIC/GND swaps of an attached audio accessory have their own mode, the
+// audio stack's headset detection waits for them.
+//
+#define FSA4480_LATENCY_VERSION 3
+#define FSA4480_LATENCY_BUCKET_COUNT 24
+
+typedef enum _FSA4480_LATENCY_MODE
+{
+	FSA4480_LATENCY_MODE_CC1,
+	FSA4480_LATENCY_MODE_CC2,
+	FSA4480_LATENCY_MODE_DP_DISCONNECTED,
+	FSA4480_LATENCY_MODE_AUDIO_ACCESSORY,
+	FSA4480_LATENCY_MODE_MIC_GND_SWAP,
+	FSA4480_LATENCY_MODE_COUNT
+} FSA4480_LATENCY_MODE;
+
+typedef enum _FSA4480_LATENCY_STAGE
+{
+	FSA4480_LATENCY_STAGE_PROGRAMMED,
+	FSA4480_LATENCY_STAGE_SETTLED,
+	FSA4480_LATENCY_STAGE_COMPLETE,
+	FSA4480_LATENCY_STAGE_COUNT
+} FSA4480_LATENCY_STAGE;
+
+typedef enum _FSA4480_LATENCY_SOURCE
+{
+	FSA4480_LATENCY_SOURCE_ACPI,
+	FSA4480_LATENCY_SOURCE_GPIO,
+	FSA4480_LATENCY_SOURCE_COUNT
+} FSA4480_LATENCY_SOURCE;
+
+typedef struct _FSA4480_LATENCY_HISTOGRAM
+{
+	ULONG Count;
+	ULONG MaxUs;
+	ULONG Buckets[FSA4480_LATENCY_BUCKET_COUNT];
+} FSA4480_LATENCY_HISTOGRAM, *PFSA4480_LATENCY_HISTOGRAM;
+
+typedef struct _FSA4480_SWITCH_LATENCY
+{
+	ULONG Version;
+	FSA4480_LATENCY_HISTOGRAM Histograms[FSA4480_LATENCY_MODE_COUNT][FSA4480_LATENCY_STAGE_COUNT];
+	FSA4480_LATENCY_HISTOGRAM Sources[FSA4480_LATENCY_SOURCE_COUNT][FSA4480_LATENCY_STAGE_COUNT];
+	FSA4480_LATENCY_HISTOGRAM AcpiLag;
+} FSA4480_SWITCH_LATENCY, *PFSA4480_SWITCH_LATENCY;
+
+//
+// EN power gating
+//
+// The FSA4480 is powered down through EN while CC_OUT reports open and no
+// audio accessory is attached for longer than HysteresisMs. GatedTimeUs
+// and PoweredTimeUs include the period in progress, their sum is the time
+// since the device started.
+//
+#define FSA4480_POWER_VERSION 1
+
+typedef struct _FSA4480_POWER_STATISTICS
+{
+	ULONG Version;
+	ULONG Gated;
+	ULONG HysteresisMs;
+	ULONG GateCount;
+	ULONGLONG GatedTimeUs;
+	ULONGLONG PoweredTimeUs;
+} FSA4480_POWER_STATISTICS, *PFSA4480_POWER_STATISTICS;
+
+//
+// Device start
+//
+// InitialCCOut is the CC_OUT value (0 CC1, 1 CC2, 2 open) the chip was
+// programmed with, the chip always starts open and the attach arrives
+// through ACPI. PrepareHardwareUs is the time PnP start waited on us,
+// StartToSwitchedUs runs from the same point until the mux holds the
+// initial configuration. With Asynchronous start the second one
+// completes after the first. ChipStatus is the NTSTATUS of the chip
+// programming, Transactions and BusTimeUs are the I2C traffic of the
+// whole start.
+//
+#define FSA4480_START_VERSION 3
+
+typedef struct _FSA4480_START_STATISTICS
+{
+	ULONG Version;
+	ULONG InitialCCOut;
+	ULONG Transactions;
+	ULONGLONG BusTimeUs;
+	ULONGLONG StartToSwitchedUs;
+	ULONGLONG PrepareHardwareUs;
+	ULONG Asynchronous;
+	LONG ChipStatus;
+} FSA4480_START_STATISTICS, *PFSA4480_START_STATISTICS;
+
+//
+// I2C bus traffic since the device started. RequestsAllocated is the
+// number of request objects created for it, without reuse there would
+// be one per transaction. RequestsReused is the number of transactions
+// sent on a preallocated request. BytesCopied is the number of bytes
+// staged through driver buffers, ZeroCopyBytes the write payload
+// transferred in place.
+//
+#define FSA4480_BUS_VERSION 2
+
+typedef struct _FSA4480_BUS_STATISTICS
+{
+	ULONG Version;
+	ULONG Transactions;
+	ULONG BytesWritten;
+	ULONG BytesRead;
+	ULONGLONG BusTimeUs;
+	ULONG RequestsAllocated;
+	ULONG RequestsReused;
+	ULONG BytesCopied;
+	ULONG ZeroCopyBytes;
+} FSA4480_BUS_STATISTICS, *PFSA4480_BUS_STATISTICS;
+
+//
+// Switch states. Every state is a SWITCH_CONTROL routing and a
+// SWITCH_SETTINGS enable mask, see gStateTable. UNKNOWN is only ever a
+// source state: the chip was just powered or a transition failed halfway.
+//
+typedef enum _FSA4480_STATE
+{
+	FSA4480_STATE_USB_SAFE,
+	FSA4480_STATE_DP_CC1,
+	FSA4480_STATE_DP_CC2,
+	FSA4480_STATE_AUDIO_ACCESSORY,
+	FSA4480_STATE_AUDIO_MIC_GND_SWAPPED,
+	FSA4480_STATE_COUNT,
+	FSA4480_STATE_UNKNOWN = FSA4480_STATE_COUNT
+} FSA4480_STATE;
+
+//
+// Switch timing profiles, images of the SLOW_* and DELAY_* registers
+// trading switch latency against audio pop. FAST closes every switch at
+// once, QUIET ramps them.
+//
+typedef enum _FSA4480_PROFILE
+{
+	FSA4480_PROFILE_FAST,
+	FSA4480_PROFILE_BALANCED,
+	FSA4480_PROFILE_QUIET,
+	FSA4480_PROFILE_COUNT
+} FSA4480_PROFILE;
+
+//
+// Mux state as of the last completed transition or power down
+//
+// Orientation is the CC_OUT value (0 CC1, 1 CC2, 2 open) the mux was last
+// switched for and Partner the USBC_PARTNER last reported. Profile is the
+// FSA4480_PROFILE programmed, FSA4480_PROFILE_COUNT if none is. Registers
+// holds the register image the driver applied, only the registers set in
+// RegisterValidMask are known. Generation starts at 1 and is incremented
+// by every update, 0 means the chip was never started.
+//
+// A transition failing on the bus soft-resets the chip through its RESET
+// register and replays the state in one go. RecoveryAttempts counts
+// those, RecoverySucceeded the ones that brought the mux to its target.
+// RecoverySuppressed counts failures left alone because a recovery had
+// just run.
+//
+#define FSA4480_STATE_SNAPSHOT_VERSION 3
+#define FSA4480_STATE_SNAPSHOT_REGISTER_COUNT 0x20
+
+#define FSA4480_ORIENTATION_CC1 0
+#define FSA4480_ORIENTATION_CC2 1
+#define FSA4480_ORIENTATION_OPEN 2
+
+typedef struct _FSA4480_STATE_SNAPSHOT
+{
+	ULONG Version;
+	ULONG Generation;
+	ULONG State;
+	ULONG Orientation;
+	ULONG Partner;
+	ULONG Profile;
+	ULONG RecoveryAttempts;
+	ULONG RecoverySucceeded;
+	ULONG RecoverySuppressed;
+	ULONG RegisterValidMask;
+	UCHAR Registers[FSA4480_STATE_SNAPSHOT_REGISTER_COUNT];
+} FSA4480_STATE_SNAPSHOT, *PFSA4480_STATE_SNAPSHOT;
+
+//
+// I2C flight recorder, the last FSA4480_SPB_TRACE_RECORD_COUNT transfers
+//
+// Every write or read leaves one record, including each step of a batched
+// sequence (FSA4480_SPB_TRACE_BATCH, all steps carry the timing and status
+// of the whole sequence) and transfers sent asynchronously from the CC_OUT
+// interrupt (FSA4480_SPB_TRACE_ASYNC). Sequence numbers every transfer
+// since the driver loaded, starting at 1. Slots that are empty or were
+// overwritten while being copied have Sequence 0. Timestamp and
+// DurationTicks are in ticks of Frequency, Data holds the first bytes
+// written or read when Status is a success.
+//
+#define FSA4480_SPB_TRACE_VERSION 1
+#define FSA4480_SPB_TRACE_RECORD_COUNT 256
+#define FSA4480_SPB_TRACE_DATA_BYTES 4
+
+#define FSA4480_SPB_TRACE_READ 0x01
+#define FSA4480_SPB_TRACE_BATCH 0x02
+#define FSA4480_SPB_TRACE_ASYNC 0x04
+
+typedef struct _FSA4480_SPB_TRACE_RECORD
+{
+	ULONG Sequence;
+	UCHAR Flags;
+	UCHAR Register;
+	USHORT Length;
+	LONG Status;
+	ULONG DurationTicks;
+	LONGLONG Timestamp;
+	UCHAR Data[FSA4480_SPB_TRACE_DATA_BYTES];
+	ULONG Reserved;
+} FSA4480_SPB_TRACE_RECORD, *PFSA4480_SPB_TRACE_RECORD;
+
+typedef struct _FSA4480_SPB_TRACE
+{
+	ULONG Version;
+	ULONG RecordCount;
+	ULONG NextSequence;
+	ULONG Reserved;
+	LONGLONG Frequency;
+	FSA4480_SPB_TRACE_RECORD Records[FSA4480_SPB_TRACE_RECORD_COUNT];
+} FSA4480_SPB_TRACE, *PFSA4480_SPB_TRACE;
+
+//
+// Register file as read from the chip in one burst from 0x00, next to the
+// image the driver expects it to hold
+//
+// Status is the NTSTATUS of the read, Registers is only valid when it is
+// a success. A gated chip is not read, Status is then
+// STATUS_DEVICE_POWERED_OFF. Expected holds the registers set in
+// ExpectedValidMask, status registers and registers the driver never
+// wrote or read are not expected to hold anything. MismatchMask has a bit
+// set for every expected register the chip holds a different value in.
+// State is the FSA4480_STATE the mux is believed to be in, Timestamp the
+// time the read completed in ticks of Frequency.
+//
+#define FSA4480_REGISTER_DUMP_VERSION 1
+#define FSA4480_REGISTER_DUMP_COUNT 0x20
+
+typedef struct _FSA4480_REGISTER_DUMP
+{
+	ULONG Version;
+	LONG Status;
+	ULONG State;
+	ULONG ExpectedValidMask;
+	ULONG MismatchMask;
+	ULONG Reserved;
+	LONGLONG Timestamp;
+	LONGLONG Frequency;
+	UCHAR Registers[FSA4480_REGISTER_DUMP_COUNT];
+	UCHAR Expected[FSA4480_REGISTER_DUMP_COUNT];
+} FSA4480_REGISTER_DUMP, *PFSA4480_REGISTER_DUMP;
\ No newline at end of file
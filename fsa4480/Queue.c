@@ -0,0 +1,482 @@
+/*++
+
+Module Name:
+
+	queue.c
+
+Abstract:
+
+	This file contains the queue entry points and callbacks.
+
+Environment:
+
+	Kernel-mode Driver Framework
+
+--*/
+
+#include "driver.h"
+#include "queue.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, fsa4480QueueInitialize)
+#endif
+
+NTSTATUS
+fsa4480QueueInitialize(
+	_In_ WDFDEVICE Device)
+/*++
+
+Routine Description:
+
+	The I/O dispatch callbacks for the frameworks device object
+	are configured in this function.
+
+	A single default I/O Queue is configured for parallel request
+	processing. The queue only serves diagnostic IOCTLs, so it is not
+	power managed. The register dump is the only one reaching the
+	hardware, it checks for itself that the chip is up.
+
+Arguments:
+
+	Device - Handle to a framework device object.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+{
+	WDFQUEUE queue;
+	NTSTATUS status;
+	WDF_IO_QUEUE_CONFIG queueConfig;
+	WDF_OBJECT_ATTRIBUTES queueAttributes;
+
+	PAGED_CODE();
+
+	WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(
+		&queueConfig,
+		WdfIoQueueDispatchParallel);
+
+	queueConfig.EvtIoDeviceControl = fsa4480EvtIoDeviceControl;
+	queueConfig.PowerManaged = WdfFalse;
+
+	//
+	// Some statistics are collected under the chip wait lock
+	//
+	WDF_OBJECT_ATTRIBUTES_INIT(&queueAttributes);
+	queueAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+	status = WdfIoQueueCreate(
+		Device,
+		&queueConfig,
+		&queueAttributes,
+		&queue);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(TRACE_LEVEL_ERROR, TRACE_QUEUE, "WdfIoQueueCreate failed %!STATUS!", status);
+		return status;
+	}
+
+	return status;
+}
+
+VOID fsa4480EvtIoDeviceControl(
+	_In_ WDFQUEUE Queue,
+	_In_ WDFREQUEST Request,
+	_In_ size_t OutputBufferLength,
+	_In_ size_t InputBufferLength,
+	_In_ ULONG IoControlCode)
+/*++
+
+Routine Description:
+
+	This event is invoked when the framework receives IRP_MJ_DEVICE_CONTROL request.
+
+Arguments:
+
+	Queue - Handle to the framework queue object that is associated with the
+			I/O request.
+
+	Request - Handle to a framework request object.
+
+	OutputBufferLength - Size of the output buffer in bytes
+
+	InputBufferLength - Size of the input buffer in bytes
+
+	IoControlCode - I/O control code.
+
+Return Value:
+
+	VOID
+
+--*/
+{
+	NTSTATUS status = STATUS_INVALID_DEVICE_REQUEST;
+	WDFDEVICE device = WdfIoQueueGetDevice(Queue);
+	ULONG_PTR information = 0;
+	PVOID outputBuffer;
+	PFSA4480_REGISTER_DUMP dump;
+	SPB_OPERATION operation;
+
+	UNREFERENCED_PARAMETER(OutputBufferLength);
+	UNREFERENCED_PARAMETER(InputBufferLength);
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_QUEUE,
+		"%!FUNC! Queue 0x%p, Request 0x%p IoControlCode %d",
+		Queue,
+		Request,
+		IoControlCode);
+
+	switch (IoControlCode)
+	{
+	case IOCTL_FSA4480_GET_SWITCH_LATENCY:
+	{
+		status = WdfRequestRetrieveOutputBuffer(
+			Request,
+			sizeof(FSA4480_SWITCH_LATENCY),
+			&outputBuffer,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_QUEUE,
+				"Output buffer too small for switch latency - %!STATUS!",
+				status);
+			break;
+		}
+
+		FSA4480_GetSwitchLatency(
+			&DeviceGetContext(device)->Chip,
+			(PFSA4480_SWITCH_LATENCY)outputBuffer);
+		information = sizeof(FSA4480_SWITCH_LATENCY);
+		break;
+	}
+	case IOCTL_FSA4480_GET_POWER_STATISTICS:
+	{
+		status = WdfRequestRetrieveOutputBuffer(
+			Request,
+			sizeof(FSA4480_POWER_STATISTICS),
+			&outputBuffer,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_QUEUE,
+				"Output buffer too small for power statistics - %!STATUS!",
+				status);
+			break;
+		}
+
+		fsa4480PowerGateGetStatistics(
+			device,
+			(PFSA4480_POWER_STATISTICS)outputBuffer);
+		information = sizeof(FSA4480_POWER_STATISTICS);
+		break;
+	}
+	case IOCTL_FSA4480_GET_START_STATISTICS:
+	{
+		status = WdfRequestRetrieveOutputBuffer(
+			Request,
+			sizeof(FSA4480_START_STATISTICS),
+			&outputBuffer,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_QUEUE,
+				"Output buffer too small for start statistics - %!STATUS!",
+				status);
+			break;
+		}
+
+		//
+		// An asynchronous start fills these in from its work item
+		//
+		WdfWaitLockAcquire(DeviceGetContext(device)->ChipLock, NULL);
+
+		RtlCopyMemory(
+			outputBuffer,
+			&DeviceGetContext(device)->StartStatistics,
+			sizeof(FSA4480_START_STATISTICS));
+
+		WdfWaitLockRelease(DeviceGetContext(device)->ChipLock);
+		((PFSA4480_START_STATISTICS)outputBuffer)->Version = FSA4480_START_VERSION;
+		information = sizeof(FSA4480_START_STATISTICS);
+		break;
+	}
+	case IOCTL_FSA4480_GET_BUS_STATISTICS:
+	{
+		PDEVICE_CONTEXT devContext = DeviceGetContext(device);
+		PFSA4480_BUS_STATISTICS bus;
+		SPB_STATISTICS spbStatistics;
+		LARGE_INTEGER frequency;
+
+		status = WdfRequestRetrieveOutputBuffer(
+			Request,
+			sizeof(FSA4480_BUS_STATISTICS),
+			&outputBuffer,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_QUEUE,
+				"Output buffer too small for bus statistics - %!STATUS!",
+				status);
+			break;
+		}
+
+		if (!devContext->InitializedSpbHardware)
+		{
+			status = STATUS_DEVICE_NOT_READY;
+			break;
+		}
+
+		SpbGetStatistics(&devContext->I2CContext, &spbStatistics);
+		KeQueryPerformanceCounter(&frequency);
+
+		bus = (PFSA4480_BUS_STATISTICS)outputBuffer;
+		RtlZeroMemory(bus, sizeof(FSA4480_BUS_STATISTICS));
+
+		bus->Version = FSA4480_BUS_VERSION;
+		bus->Transactions = spbStatistics.Transactions;
+		bus->BytesWritten = spbStatistics.BytesWritten;
+		bus->BytesRead = spbStatistics.BytesRead;
+		bus->BusTimeUs = (ULONGLONG)spbStatistics.BusTime * 1000000 / frequency.QuadPart;
+		bus->RequestsAllocated = spbStatistics.RequestsAllocated;
+		bus->RequestsReused = spbStatistics.RequestsReused;
+		bus->BytesCopied = spbStatistics.BytesCopied;
+		bus->ZeroCopyBytes = spbStatistics.ZeroCopyBytes;
+
+		information = sizeof(FSA4480_BUS_STATISTICS);
+		break;
+	}
+	case IOCTL_FSA4480_GET_STATE:
+	{
+		status = WdfRequestRetrieveOutputBuffer(
+			Request,
+			sizeof(FSA4480_STATE_SNAPSHOT),
+			&outputBuffer,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_QUEUE,
+				"Output buffer too small for state snapshot - %!STATUS!",
+				status);
+			break;
+		}
+
+		//
+		// Lock-free, never waits for a switch in progress
+		//
+		FSA4480_ReadState(
+			&DeviceGetContext(device)->Chip,
+			(PFSA4480_STATE_SNAPSHOT)outputBuffer);
+		information = sizeof(FSA4480_STATE_SNAPSHOT);
+		break;
+	}
+	case IOCTL_FSA4480_GET_SPB_TRACE:
+	{
+		PDEVICE_CONTEXT devContext = DeviceGetContext(device);
+		PFSA4480_SPB_TRACE trace;
+		SPB_TRACE_RECORD record;
+		LARGE_INTEGER frequency;
+		ULONG i;
+
+		status = WdfRequestRetrieveOutputBuffer(
+			Request,
+			sizeof(FSA4480_SPB_TRACE),
+			&outputBuffer,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_QUEUE,
+				"Output buffer too small for SPB trace - %!STATUS!",
+				status);
+			break;
+		}
+
+		KeQueryPerformanceCounter(&frequency);
+
+		trace = (PFSA4480_SPB_TRACE)outputBuffer;
+		RtlZeroMemory(trace, sizeof(FSA4480_SPB_TRACE));
+
+		trace->Version = FSA4480_SPB_TRACE_VERSION;
+		trace->RecordCount = FSA4480_SPB_TRACE_RECORD_COUNT;
+		trace->NextSequence = SpbGetTraceSequence(&devContext->I2CContext) + 1;
+		trace->Frequency = frequency.QuadPart;
+
+		//
+		// Lock-free, the bus keeps running while the ring is copied
+		//
+		for (i = 0; i < FSA4480_SPB_TRACE_RECORD_COUNT; i++)
+		{
+			if (!SpbGetTraceRecord(&devContext->I2CContext, i, &record))
+			{
+				continue;
+			}
+
+			trace->Records[i].Sequence = (ULONG)record.Sequence;
+			trace->Records[i].Flags = record.Flags;
+			trace->Records[i].Register = record.Address;
+			trace->Records[i].Length = record.Length;
+			trace->Records[i].Status = record.Status;
+			trace->Records[i].DurationTicks = record.Duration;
+			trace->Records[i].Timestamp = record.StartTime;
+
+			RtlCopyMemory(
+				trace->Records[i].Data,
+				record.Data,
+				sizeof(trace->Records[i].Data));
+		}
+
+		information = sizeof(FSA4480_SPB_TRACE);
+		break;
+	}
+	case IOCTL_FSA4480_GET_REGISTER_DUMP:
+	{
+		PDEVICE_CONTEXT devContext = DeviceGetContext(device);
+
+		status = WdfRequestRetrieveOutputBuffer(
+			Request,
+			sizeof(FSA4480_REGISTER_DUMP),
+			&outputBuffer,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceEvents(
+				TRACE_LEVEL_ERROR,
+				TRACE_QUEUE,
+				"Output buffer too small for register dump - %!STATUS!",
+				status);
+			break;
+		}
+
+		//
+		// The expected image and the chip are only consistent between
+		// transitions. The read is queued before the chip lock is
+		// released, the next transition's transfers wait for it. The
+		// request completes from fsa4480RegisterDumpComplete, a failed
+		// read is reported in the dump.
+		//
+		WdfWaitLockAcquire(devContext->ChipLock, NULL);
+
+		if (!devContext->InitializedFSAHardware)
+		{
+			WdfWaitLockRelease(devContext->ChipLock);
+			status = STATUS_DEVICE_NOT_READY;
+			break;
+		}
+
+		dump = (PFSA4480_REGISTER_DUMP)outputBuffer;
+
+		if (FSA4480_BeginRegisterDump(
+				&devContext->Chip,
+				!devContext->PowerGate.Gated,
+				dump))
+		{
+			operation.Read = TRUE;
+			operation.Address = 0x00;
+			operation.Length = FSA4480_REGISTER_COUNT;
+			operation.Data = dump->Registers;
+
+			status = SpbSubmitAsynchronously(
+				&devContext->I2CContext,
+				&operation,
+				1,
+				fsa4480RegisterDumpComplete,
+				Request);
+
+			if (NT_SUCCESS(status))
+			{
+				WdfWaitLockRelease(devContext->ChipLock);
+				return;
+			}
+
+			FSA4480_CompleteRegisterDump(
+				dump,
+				status,
+				KeQueryPerformanceCounter(NULL).QuadPart);
+		}
+
+		WdfWaitLockRelease(devContext->ChipLock);
+
+		status = STATUS_SUCCESS;
+		information = sizeof(FSA4480_REGISTER_DUMP);
+		break;
+	}
+	default:
+		break;
+	}
+
+	WdfRequestCompleteWithInformation(Request, status, information);
+}
+
+VOID
+fsa4480RegisterDumpComplete(
+	_In_ NTSTATUS Status,
+	_In_opt_ PVOID Context)
+/*++
+
+Routine Description:
+
+	Completion routine of the register file read queued for
+	IOCTL_FSA4480_GET_REGISTER_DUMP. Compares the register file against
+	the expected image and completes the request. Runs at
+	IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+	Status - Status of the register file read.
+
+	Context - The IOCTL request.
+
+Return Value:
+
+	VOID
+
+--*/
+{
+	WDFREQUEST request = (WDFREQUEST)Context;
+	PVOID outputBuffer;
+	NTSTATUS status;
+
+	status = WdfRequestRetrieveOutputBuffer(
+		request,
+		sizeof(FSA4480_REGISTER_DUMP),
+		&outputBuffer,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		WdfRequestComplete(request, status);
+		return;
+	}
+
+	FSA4480_CompleteRegisterDump(
+		(PFSA4480_REGISTER_DUMP)outputBuffer,
+		Status,
+		KeQueryPerformanceCounter(NULL).QuadPart);
+
+	WdfRequestCompleteWithInformation(
+		request,
+		STATUS_SUCCESS,
+		sizeof(FSA4480_REGISTER_DUMP));
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+/*++
+
+Module Name:
+
+	queue.h
+
+Abstract:
+
+	This file contains the queue definitions.
+
+Environment:
+
+	Kernel-mode Driver Framework
+
+--*/
+
+#pragma once
+
+NTSTATUS
+fsa4480QueueInitialize(
+	_In_ WDFDEVICE Device);
+
+//
+// Events from the IoQueue object
+//
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL fsa4480EvtIoDeviceControl;
+
+//
+// Completion of the asynchronous register file read
+//
+SPB_COMPLETION_ROUTINE fsa4480RegisterDumpComplete;
\ No newline at end of file
@@ -27,10 +27,103 @@
 #define RESHUB_USE_HELPER_ROUTINES
 #include <reshub.h>
 #include <gpio.h>
+#include <spb.h>
 #include <wdf.h>
 #include <spb.tmh>
 
-#define I2C_VERBOSE_LOGGING 0
+VOID
+SpbTraceTransfer(
+	IN SPB_CONTEXT *SpbContext,
+	IN UCHAR Flags,
+	IN UCHAR Address,
+	IN PVOID Data,
+	IN ULONG Length,
+	IN LONGLONG StartTime,
+	IN LONGLONG EndTime,
+	IN NTSTATUS Status)
+/*++
+
+  Routine Description:
+
+	This helper routine appends a transfer to the flight recorder.
+	It takes no lock and can be called at any IRQL.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Flags      - SPB_TRACE_FLAG_XXX
+	Address    - The I2C register address of the transfer
+	Data       - The data transferred, NULL if there is none
+	Length     - The amount of data transferred at the above address
+	StartTime  - Performance counter when the transfer was sent
+	EndTime    - Performance counter when it completed
+	Status     - Status of the transfer
+
+  Return Value:
+
+	None
+
+--*/
+{
+	SPB_TRACE_RECORD *record;
+	LONG claim;
+
+	claim = InterlockedIncrement(&SpbContext->TraceNext) - 1;
+	record = &SpbContext->Trace[(ULONG)claim % SPB_TRACE_RECORD_COUNT];
+
+	//
+	// Readers drop the record while Sequence is 0 or changed under them.
+	// Two writers only meet on a slot if SPB_TRACE_RECORD_COUNT other
+	// transfers were appended while one of them was here.
+	//
+	InterlockedExchange(&record->Sequence, 0);
+
+	record->Flags = Flags;
+	record->Address = Address;
+	record->Length = (USHORT)min(Length, MAXUSHORT);
+	record->StartTime = StartTime;
+	record->Duration = (ULONG)(EndTime - StartTime);
+	record->Status = Status;
+
+	RtlZeroMemory(record->Data, sizeof(record->Data));
+
+	if (Data != NULL)
+	{
+		RtlCopyMemory(record->Data, Data, min(Length, sizeof(record->Data)));
+	}
+
+	InterlockedExchange(&record->Sequence, claim + 1);
+}
+
+VOID
+SpbAsyncWaitForIdle(
+	IN SPB_CONTEXT *SpbContext)
+/*++
+
+  Routine Description:
+
+	This helper routine waits for the asynchronous operations
+	submitted so far to complete. Synchronous transfers call it
+	under SpbLock, so they stay behind the operations submitted
+	before them.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+
+  Return Value:
+
+	None
+
+--*/
+{
+	KeWaitForSingleObject(
+		&SpbContext->AsyncIdleEvent,
+		Executive,
+		KernelMode,
+		FALSE,
+		NULL);
+}
 
 NTSTATUS
 SpbDoWriteDataSynchronously(
@@ -49,8 +142,10 @@ SpbDoWriteDataSynchronously(
 
 	SpbContext - Pointer to the current device context
 	Address    - The I2C register address to write to
-	Data       - A buffer to receive the data at at the above address
-	Length     - The amount of data to be read from the above address
+	Data       - The data to write at the above address, it is
+	             transferred in place and must stay valid until
+	             the call returns
+	Length     - The amount of data to be written at the above address
 
   Return Value:
 
@@ -58,81 +153,98 @@ SpbDoWriteDataSynchronously(
 
 --*/
 {
-	PUCHAR buffer;
+	UCHAR address;
 	ULONG length;
-	WDFMEMORY memory;
+	SPB_TRANSFER_BUFFER_LIST_ENTRY bufferList[2];
+	SPB_TRANSFER_LIST sequence;
 	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	WDF_REQUEST_REUSE_PARAMS reuseParams;
 	NTSTATUS status;
+	ULONG_PTR bytesTransferred;
+	LARGE_INTEGER startTime, endTime;
 
 	//
-	// The address pointer and data buffer must be combined
-	// into one contiguous buffer representing the write transaction.
+	// The address pointer and the caller's payload go out as one write
+	// transfer described by a two element buffer list, the controller
+	// gathers them without a staging copy.
 	//
+	address = Address;
 	length = Length + 1;
-	memory = NULL;
+	bytesTransferred = 0;
 
-	if (length > DEFAULT_SPB_BUFFER_SIZE)
-	{
-		status = WdfMemoryCreate(
-			WDF_NO_OBJECT_ATTRIBUTES,
-			NonPagedPool,
-			SPB_POOL_TAG,
-			length,
-			&memory,
-			&buffer);
+	bufferList[0].Buffer = &address;
+	bufferList[0].BufferCb = sizeof(address);
+	bufferList[1].Buffer = Data;
+	bufferList[1].BufferCb = Length;
 
-		if (!NT_SUCCESS(status))
-		{
-			TraceEvents(
-				TRACE_LEVEL_ERROR,
-				TRACE_DRIVER,
-				"Error allocating memory for Spb write - 0x%08lX",
-				status);
-			goto exit;
-		}
+	SPB_TRANSFER_LIST_INIT(&sequence, 1);
 
-		WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
-			&memoryDescriptor,
-			memory,
-			NULL);
-	}
-	else
-	{
-		buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->WriteMemory, NULL);
+	sequence.Transfers[0] = SPB_TRANSFER_LIST_ENTRY_INIT_BUFFER_LIST(
+		SpbTransferDirectionToDevice,
+		0,
+		bufferList,
+		Length != 0 ? 2 : 1);
 
-		WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-			&memoryDescriptor,
-			(PVOID)buffer,
-			length);
-	}
+	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+		&memoryDescriptor,
+		(PVOID)&sequence,
+		sizeof(sequence));
 
 	//
-	// Transaction starts by specifying the address bytes
+	// The write request is allocated once by SpbTargetInitialize, it only
+	// needs to be reset before being sent again
 	//
-	RtlCopyMemory(buffer, &Address, sizeof(Address));
+	WDF_REQUEST_REUSE_PARAMS_INIT(
+		&reuseParams,
+		WDF_REQUEST_REUSE_NO_FLAGS,
+		STATUS_SUCCESS);
 
-	//
-	// Address is followed by the data payload
-	//
-	RtlCopyMemory((buffer + sizeof(Address)), Data, length - sizeof(Address));
+	status = WdfRequestReuse(SpbContext->WriteRequest, &reuseParams);
 
-#if I2C_VERBOSE_LOGGING
-	DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "I2CWRITE: LENGTH=%d", length);
-	for (ULONG j = 0; j < length; j++)
+	if (!NT_SUCCESS(status))
 	{
-		UCHAR byte = *(buffer + j);
-		DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, " %02hhX", byte);
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error reusing Spb write request - 0x%08lX",
+			status);
+		goto exit;
 	}
-	DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "\n");
-#endif
 
-	status = WdfIoTargetSendWriteSynchronously(
+	startTime = KeQueryPerformanceCounter(NULL);
+
+	status = WdfIoTargetSendIoctlSynchronously(
 		SpbContext->SpbIoTarget,
-		NULL,
+		SpbContext->WriteRequest,
+		IOCTL_SPB_EXECUTE_SEQUENCE,
 		&memoryDescriptor,
 		NULL,
 		NULL,
-		NULL);
+		&bytesTransferred);
+
+	endTime = KeQueryPerformanceCounter(NULL);
+
+	SpbContext->Statistics.Transactions++;
+	SpbContext->Statistics.RequestsReused++;
+	SpbContext->Statistics.BytesWritten += length;
+	SpbContext->Statistics.ZeroCopyBytes += Length;
+	SpbContext->Statistics.BusTime += endTime.QuadPart - startTime.QuadPart;
+
+	if (NT_SUCCESS(status) &&
+		bytesTransferred != length)
+	{
+		status = STATUS_IO_DEVICE_ERROR;
+	}
+
+	SpbTraceTransfer(
+		SpbContext,
+		0,
+		Address,
+		Data,
+		Length,
+		startTime.QuadPart,
+		endTime.QuadPart,
+		status);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -141,19 +253,16 @@ SpbDoWriteDataSynchronously(
 			TRACE_DRIVER,
 			"Error writing to Spb - 0x%08lX",
 			status);
+
 		goto exit;
 	}
 
 exit:
 
-	if (NULL != memory)
-	{
-		WdfObjectDelete(memory);
-	}
-
 	return status;
 }
 
+
 NTSTATUS
 SpbWriteDataSynchronously(
 	IN SPB_CONTEXT *SpbContext,
@@ -166,7 +275,9 @@ SpbWriteDataSynchronously(
 
 	This routine abstracts creating and sending an I/O
 	request (I2C Write) to the Spb I/O target and utilizes
-	a helper routine to do work inside of locked code.
+	a helper routine to do work inside of locked code. The
+	data is not staged, the lock only orders the writes on
+	the shared write request.
 
   Arguments:
 
@@ -185,6 +296,8 @@ SpbWriteDataSynchronously(
 
 	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
 
+	SpbAsyncWaitForIdle(SpbContext);
+
 	status = SpbDoWriteDataSynchronously(
 		SpbContext,
 		Address,
@@ -207,7 +320,10 @@ SpbReadDataSynchronously(
   Routine Description:
 
 	This helper routine abstracts creating and sending an I/O
-	request (I2C Read) to the Spb I/O target.
+	request (I2C Read) to the Spb I/O target. The register address
+	write and the data read are issued as a single Spb sequence, so
+	the controller uses a repeated start between them instead of a
+	STOP and a second transaction.
 
   Arguments:
 
@@ -223,35 +339,22 @@ SpbReadDataSynchronously(
 --*/
 {
 	PUCHAR buffer;
+	PUCHAR addressBuffer;
 	WDFMEMORY memory;
 	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	SPB_TRANSFER_LIST_AND_ENTRIES(2) sequence;
+	WDF_REQUEST_REUSE_PARAMS reuseParams;
 	NTSTATUS status;
-	ULONG_PTR bytesRead;
+	ULONG_PTR bytesTransferred;
+	LARGE_INTEGER startTime, endTime;
 
 	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
 
+	SpbAsyncWaitForIdle(SpbContext);
+
 	memory = NULL;
 	status = STATUS_INVALID_PARAMETER;
-	bytesRead = 0;
-
-	//
-	// Read transactions start by writing an address pointer
-	//
-	status = SpbDoWriteDataSynchronously(
-		SpbContext,
-		Address,
-		NULL,
-		0);
-
-	if (!NT_SUCCESS(status))
-	{
-		TraceEvents(
-			TRACE_LEVEL_ERROR,
-			TRACE_DRIVER,
-			"Error setting address pointer for Spb read - 0x%08lX",
-			status);
-		goto exit;
-	}
+	bytesTransferred = 0;
 
 	if (Length > DEFAULT_SPB_BUFFER_SIZE)
 	{
@@ -272,55 +375,107 @@ SpbReadDataSynchronously(
 				status);
 			goto exit;
 		}
-
-		WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
-			&memoryDescriptor,
-			memory,
-			NULL);
 	}
 	else
 	{
 		buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->ReadMemory, NULL);
+	}
+
+	//
+	// Read transactions start by writing an address pointer, which is
+	// staged in the default write buffer so it lives in nonpaged memory.
+	//
+	addressBuffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->WriteMemory, NULL);
+	*addressBuffer = Address;
+
+	SPB_TRANSFER_LIST_INIT(&(sequence.List), 2);
+
+	sequence.List.Transfers[0] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+		SpbTransferDirectionToDevice,
+		0,
+		addressBuffer,
+		sizeof(Address));
+
+	sequence.List.Transfers[1] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+		SpbTransferDirectionFromDevice,
+		0,
+		buffer,
+		Length);
+
+	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+		&memoryDescriptor,
+		(PVOID)&sequence,
+		sizeof(sequence));
+
+	WDF_REQUEST_REUSE_PARAMS_INIT(
+		&reuseParams,
+		WDF_REQUEST_REUSE_NO_FLAGS,
+		STATUS_SUCCESS);
 
-		WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-			&memoryDescriptor,
-			(PVOID)buffer,
-			Length);
+	status = WdfRequestReuse(SpbContext->ReadRequest, &reuseParams);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error reusing Spb read request - 0x%08lX",
+			status);
+		goto exit;
 	}
 
-	status = WdfIoTargetSendReadSynchronously(
+	startTime = KeQueryPerformanceCounter(NULL);
+
+	status = WdfIoTargetSendIoctlSynchronously(
 		SpbContext->SpbIoTarget,
-		NULL,
+		SpbContext->ReadRequest,
+		IOCTL_SPB_EXECUTE_SEQUENCE,
 		&memoryDescriptor,
 		NULL,
 		NULL,
-		&bytesRead);
+		&bytesTransferred);
+
+	endTime = KeQueryPerformanceCounter(NULL);
+
+	SpbContext->Statistics.Transactions++;
+	SpbContext->Statistics.RequestsReused++;
+	SpbContext->Statistics.BytesCopied += sizeof(Address);
+	SpbContext->Statistics.BytesWritten += sizeof(Address);
+	SpbContext->Statistics.BytesRead += Length;
+	SpbContext->Statistics.BusTime += endTime.QuadPart - startTime.QuadPart;
+
+	if (NT_SUCCESS(status) &&
+		bytesTransferred != sizeof(Address) + Length)
+	{
+		status = STATUS_IO_DEVICE_ERROR;
+	}
+
+	SpbTraceTransfer(
+		SpbContext,
+		SPB_TRACE_FLAG_READ,
+		Address,
+		NT_SUCCESS(status) ? buffer : NULL,
+		Length,
+		startTime.QuadPart,
+		endTime.QuadPart,
+		status);
 
-	if (!NT_SUCCESS(status) ||
-		bytesRead != Length)
+	if (!NT_SUCCESS(status))
 	{
 		TraceEvents(
 			TRACE_LEVEL_ERROR,
 			TRACE_DRIVER,
 			"Error reading from Spb - 0x%08lX",
 			status);
-		goto exit;
-	}
 
-#if I2C_VERBOSE_LOGGING
-	DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "I2CREAD: LENGTH=%d", Length);
-	for (ULONG j = 0; j < Length; j++)
-	{
-		UCHAR byte = *(buffer + j);
-		DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, " %02hhX", byte);
+		goto exit;
 	}
-	DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "\n");
-#endif
 
 	//
 	// Copy back to the caller's buffer
 	//
 	RtlCopyMemory(Data, buffer, Length);
+	SpbContext->Statistics.BytesCopied += Length;
 
 exit:
 	if (NULL != memory)
@@ -333,21 +488,25 @@ exit:
 	return status;
 }
 
-VOID SpbTargetDeinitialize(
-	IN WDFDEVICE FxDevice,
-	IN SPB_CONTEXT *SpbContext)
+NTSTATUS
+SpbExecuteBatch(
+	IN SPB_CONTEXT *SpbContext,
+	IN PSPB_BATCH_STEP Steps,
+	IN ULONG Count)
 /*++
 
   Routine Description:
 
-	This helper routine is used to free any members added to the SPB_CONTEXT,
-	note the SPB I/O target is parented to the device and will be
-	closed and free'd when the device is removed.
+	This routine executes a batch of register writes, reads and
+	delays as a single Spb sequence, with one lock acquisition
+	and one trip through the I/O stack. The controller issues a
+	repeated start between transfers and waits out the delays.
 
   Arguments:
 
-	FxDevice   - Handle to the framework device object
 	SpbContext - Pointer to the current device context
+	Steps      - The steps to execute in order
+	Count      - Number of steps
 
   Return Value:
 
@@ -355,100 +514,988 @@ VOID SpbTargetDeinitialize(
 
 --*/
 {
-	UNREFERENCED_PARAMETER(FxDevice);
-	UNREFERENCED_PARAMETER(SpbContext);
+	PUCHAR writeBuffer;
+	PUCHAR readBuffer;
+	ULONG writeLength;
+	ULONG readLength;
+	ULONG transferCount;
+	ULONG delayUs;
+	ULONG i;
+	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	SPB_TRANSFER_LIST_AND_ENTRIES(SPB_BATCH_MAX_TRANSFERS) sequence;
+	WDF_REQUEST_REUSE_PARAMS reuseParams;
+	NTSTATUS status;
+	ULONG_PTR bytesTransferred;
+	LARGE_INTEGER startTime, endTime;
+
+	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+	SpbAsyncWaitForIdle(SpbContext);
+
+	writeBuffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->WriteMemory, NULL);
+	readBuffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->ReadMemory, NULL);
+	writeLength = 0;
+	readLength = 0;
+	transferCount = 0;
+	delayUs = 0;
+	bytesTransferred = 0;
+	status = STATUS_INVALID_PARAMETER;
 
 	//
-	// Free any SPB_CONTEXT allocations here
+	// Size the sequence before touching the buffers
 	//
-	if (SpbContext->SpbLock != NULL)
+	for (i = 0; i < Count; i++)
 	{
-		WdfObjectDelete(SpbContext->SpbLock);
-	}
+		if (Steps[i].Type == SpbBatchStepDelay)
+		{
+			delayUs += Steps[i].DelayUs;
+			continue;
+		}
 
-	if (SpbContext->ReadMemory != NULL)
-	{
-		WdfObjectDelete(SpbContext->ReadMemory);
+		if (Steps[i].Type == SpbBatchStepWrite)
+		{
+			transferCount += 1;
+			writeLength += 1 + Steps[i].Length;
+		}
+		else
+		{
+			transferCount += 2;
+			writeLength += 1;
+			readLength += Steps[i].Length;
+		}
+
+		delayUs = 0;
 	}
 
-	if (SpbContext->WriteMemory != NULL)
+	if (transferCount == 0 ||
+		transferCount > SPB_BATCH_MAX_TRANSFERS ||
+		writeLength > DEFAULT_SPB_BUFFER_SIZE ||
+		readLength > DEFAULT_SPB_BUFFER_SIZE ||
+		delayUs != 0)
 	{
-		WdfObjectDelete(SpbContext->WriteMemory);
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Spb batch of %d steps does not fit a single sequence - 0x%08lX",
+			Count,
+			status);
+		goto exit;
 	}
-}
 
-NTSTATUS
-SpbTargetInitialize(
-	IN WDFDEVICE FxDevice,
-	IN SPB_CONTEXT *SpbContext)
-/*++
+	//
+	// Stage every write, and the address of every read, back to back in
+	// the default write buffer and point the transfers into it
+	//
+	SPB_TRANSFER_LIST_INIT(&(sequence.List), transferCount);
 
-  Routine Description:
+	writeLength = 0;
+	readLength = 0;
+	transferCount = 0;
 
-	This helper routine opens the Spb I/O target and
-	initializes a request object used for the lifetime
-	of communication between this driver and Spb.
+	for (i = 0; i < Count; i++)
+	{
+		if (Steps[i].Type == SpbBatchStepDelay)
+		{
+			delayUs += Steps[i].DelayUs;
+			continue;
+		}
 
-  Arguments:
+		writeBuffer[writeLength] = Steps[i].Address;
 
-	FxDevice   - Handle to the framework device object
-	SpbContext - Pointer to the current device context
+		if (Steps[i].Type == SpbBatchStepWrite)
+		{
+			RtlCopyMemory(&writeBuffer[writeLength + 1], Steps[i].Data, Steps[i].Length);
 
-  Return Value:
+			sequence.List.Transfers[transferCount++] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+				SpbTransferDirectionToDevice,
+				delayUs,
+				&writeBuffer[writeLength],
+				1 + Steps[i].Length);
 
-	NTSTATUS Status indicating success or failure
+			writeLength += 1 + Steps[i].Length;
+		}
+		else
+		{
+			sequence.List.Transfers[transferCount++] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+				SpbTransferDirectionToDevice,
+				delayUs,
+				&writeBuffer[writeLength],
+				1);
+
+			sequence.List.Transfers[transferCount++] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+				SpbTransferDirectionFromDevice,
+				0,
+				&readBuffer[readLength],
+				Steps[i].Length);
+
+			writeLength += 1;
+			readLength += Steps[i].Length;
+		}
 
---*/
-{
-	WDF_OBJECT_ATTRIBUTES objectAttributes;
-	WDF_IO_TARGET_OPEN_PARAMS openParams;
-	UNICODE_STRING spbDeviceName;
-	WCHAR spbDeviceNameBuffer[RESOURCE_HUB_PATH_SIZE];
-	NTSTATUS status;
+		delayUs = 0;
+	}
 
-	WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
-	objectAttributes.ParentObject = FxDevice;
+	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+		&memoryDescriptor,
+		(PVOID)&sequence,
+		sizeof(sequence));
 
-	status = WdfIoTargetCreate(
-		FxDevice,
-		&objectAttributes,
-		&SpbContext->SpbIoTarget);
+	WDF_REQUEST_REUSE_PARAMS_INIT(
+		&reuseParams,
+		WDF_REQUEST_REUSE_NO_FLAGS,
+		STATUS_SUCCESS);
+
+	status = WdfRequestReuse(SpbContext->ReadRequest, &reuseParams);
 
 	if (!NT_SUCCESS(status))
 	{
 		TraceEvents(
 			TRACE_LEVEL_ERROR,
 			TRACE_DRIVER,
-			"Error creating IoTarget object - 0x%08lX",
+			"Error reusing Spb batch request - 0x%08lX",
 			status);
-
-		WdfObjectDelete(SpbContext->SpbIoTarget);
 		goto exit;
 	}
 
-	RtlInitEmptyUnicodeString(
-		&spbDeviceName,
-		spbDeviceNameBuffer,
-		sizeof(spbDeviceNameBuffer));
+	startTime = KeQueryPerformanceCounter(NULL);
 
-	status = RESOURCE_HUB_CREATE_PATH_FROM_ID(
-		&spbDeviceName,
-		SpbContext->I2cResHubId.LowPart,
-		SpbContext->I2cResHubId.HighPart);
+	status = WdfIoTargetSendIoctlSynchronously(
+		SpbContext->SpbIoTarget,
+		SpbContext->ReadRequest,
+		IOCTL_SPB_EXECUTE_SEQUENCE,
+		&memoryDescriptor,
+		NULL,
+		NULL,
+		&bytesTransferred);
 
-	if (!NT_SUCCESS(status))
+	endTime = KeQueryPerformanceCounter(NULL);
+
+	SpbContext->Statistics.Transactions++;
+	SpbContext->Statistics.RequestsReused++;
+	SpbContext->Statistics.BytesCopied += writeLength;
+	SpbContext->Statistics.BytesWritten += writeLength;
+	SpbContext->Statistics.BytesRead += readLength;
+	SpbContext->Statistics.BusTime += endTime.QuadPart - startTime.QuadPart;
+
+	if (NT_SUCCESS(status) &&
+		bytesTransferred != writeLength + readLength)
 	{
-		TraceEvents(
-			TRACE_LEVEL_ERROR,
-			TRACE_DRIVER,
-			"Error creating Spb resource hub path string - 0x%08lX",
-			status);
-		goto exit;
+		status = STATUS_IO_DEVICE_ERROR;
 	}
 
-	WDF_IO_TARGET_OPEN_PARAMS_INIT_OPEN_BY_NAME(
-		&openParams,
-		&spbDeviceName,
+	//
+	// One record per step, all of them carry the timing and status of
+	// the whole sequence
+	//
+	readLength = 0;
+
+	for (i = 0; i < Count; i++)
+	{
+		if (Steps[i].Type == SpbBatchStepWrite)
+		{
+			SpbTraceTransfer(
+				SpbContext,
+				SPB_TRACE_FLAG_BATCH,
+				Steps[i].Address,
+				Steps[i].Data,
+				Steps[i].Length,
+				startTime.QuadPart,
+				endTime.QuadPart,
+				status);
+		}
+		else if (Steps[i].Type == SpbBatchStepRead)
+		{
+			SpbTraceTransfer(
+				SpbContext,
+				SPB_TRACE_FLAG_BATCH | SPB_TRACE_FLAG_READ,
+				Steps[i].Address,
+				NT_SUCCESS(status) ? &readBuffer[readLength] : NULL,
+				Steps[i].Length,
+				startTime.QuadPart,
+				endTime.QuadPart,
+				status);
+
+			readLength += Steps[i].Length;
+		}
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error executing Spb batch of %d transfers - 0x%08lX",
+			transferCount,
+			status);
+
+		goto exit;
+	}
+
+	//
+	// Copy read data back to the callers' buffers
+	//
+	readLength = 0;
+
+	for (i = 0; i < Count; i++)
+	{
+		if (Steps[i].Type == SpbBatchStepRead)
+		{
+			RtlCopyMemory(Steps[i].Data, &readBuffer[readLength], Steps[i].Length);
+			readLength += Steps[i].Length;
+		}
+	}
+
+	SpbContext->Statistics.BytesCopied += readLength;
+
+exit:
+	WdfWaitLockRelease(SpbContext->SpbLock);
+
+	return status;
+}
+
+//
+// Staging area of the request in flight, a read sequence points into it
+//
+typedef struct _SPB_ASYNC_STAGING
+{
+	SPB_TRANSFER_LIST_AND_ENTRIES(2) Sequence;
+	UCHAR Address;
+	UCHAR Buffer[DEFAULT_SPB_BUFFER_SIZE];
+} SPB_ASYNC_STAGING;
+
+EVT_WDF_REQUEST_COMPLETION_ROUTINE SpbAsyncCompletionRoutine;
+
+NTSTATUS
+SpbAsyncSend(
+	IN SPB_CONTEXT *SpbContext,
+	IN SPB_ASYNC_ENTRY *Entry)
+/*++
+
+  Routine Description:
+
+	This helper routine formats the asynchronous request for the
+	operation at the head of the queue and sends it to the Spb
+	I/O target.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Entry      - The queue entry to execute
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure, on success the
+	request completes through SpbAsyncCompletionRoutine
+
+--*/
+{
+	SPB_ASYNC_STAGING *staging;
+	WDFMEMORY_OFFSET memoryOffset;
+	WDF_REQUEST_REUSE_PARAMS reuseParams;
+	NTSTATUS status;
+
+	WDF_REQUEST_REUSE_PARAMS_INIT(
+		&reuseParams,
+		WDF_REQUEST_REUSE_NO_FLAGS,
+		STATUS_SUCCESS);
+
+	status = WdfRequestReuse(SpbContext->AsyncRequest, &reuseParams);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error reusing Spb asynchronous request - 0x%08lX",
+			status);
+		goto exit;
+	}
+
+	staging = (SPB_ASYNC_STAGING *)WdfMemoryGetBuffer(SpbContext->AsyncMemory, NULL);
+
+	if (Entry->Operation.Read)
+	{
+		staging->Address = Entry->Operation.Address;
+
+		SPB_TRANSFER_LIST_INIT(&(staging->Sequence.List), 2);
+
+		staging->Sequence.List.Transfers[0] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+			SpbTransferDirectionToDevice,
+			0,
+			&staging->Address,
+			sizeof(staging->Address));
+
+		staging->Sequence.List.Transfers[1] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+			SpbTransferDirectionFromDevice,
+			0,
+			staging->Buffer,
+			Entry->Operation.Length);
+
+		memoryOffset.BufferOffset = FIELD_OFFSET(SPB_ASYNC_STAGING, Sequence);
+		memoryOffset.BufferLength = sizeof(staging->Sequence);
+
+		status = WdfIoTargetFormatRequestForIoctl(
+			SpbContext->SpbIoTarget,
+			SpbContext->AsyncRequest,
+			IOCTL_SPB_EXECUTE_SEQUENCE,
+			SpbContext->AsyncMemory,
+			&memoryOffset,
+			NULL,
+			NULL);
+	}
+	else
+	{
+		RtlCopyMemory(
+			staging->Buffer,
+			Entry->WriteBuffer,
+			Entry->Operation.Length + 1);
+
+		memoryOffset.BufferOffset = FIELD_OFFSET(SPB_ASYNC_STAGING, Buffer);
+		memoryOffset.BufferLength = Entry->Operation.Length + 1;
+
+		status = WdfIoTargetFormatRequestForWrite(
+			SpbContext->SpbIoTarget,
+			SpbContext->AsyncRequest,
+			SpbContext->AsyncMemory,
+			&memoryOffset,
+			NULL);
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error formatting Spb asynchronous request - 0x%08lX",
+			status);
+		goto exit;
+	}
+
+	WdfRequestSetCompletionRoutine(
+		SpbContext->AsyncRequest,
+		SpbAsyncCompletionRoutine,
+		SpbContext);
+
+	Entry->StartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	if (!WdfRequestSend(
+			SpbContext->AsyncRequest,
+			SpbContext->SpbIoTarget,
+			WDF_NO_SEND_OPTIONS))
+	{
+		status = WdfRequestGetStatus(SpbContext->AsyncRequest);
+
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error sending Spb asynchronous request - 0x%08lX",
+			status);
+
+		if (NT_SUCCESS(status))
+		{
+			status = STATUS_IO_DEVICE_ERROR;
+		}
+	}
+
+exit:
+
+	return status;
+}
+
+VOID
+SpbAsyncComplete(
+	IN SPB_CONTEXT *SpbContext,
+	IN NTSTATUS Status,
+	IN ULONG_PTR BytesTransferred)
+/*++
+
+  Routine Description:
+
+	This helper routine retires the operation at the head of the
+	queue. A failed operation also retires the rest of its
+	submission, the submission's completion routine is called
+	after its last operation or the failed one.
+
+  Arguments:
+
+	SpbContext       - Pointer to the current device context
+	Status           - Status of the operation at the head
+	BytesTransferred - Number of bytes the Spb I/O target transferred
+
+  Return Value:
+
+	None
+
+--*/
+{
+	SPB_ASYNC_ENTRY *entry;
+	SPB_ASYNC_STAGING *staging;
+	PSPB_COMPLETION_ROUTINE completionRoutine = NULL;
+	PVOID context = NULL;
+	BOOLEAN last;
+	LONGLONG endTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	staging = (SPB_ASYNC_STAGING *)WdfMemoryGetBuffer(SpbContext->AsyncMemory, NULL);
+
+	WdfSpinLockAcquire(SpbContext->AsyncLock);
+
+	entry = &SpbContext->AsyncQueue[SpbContext->AsyncHead];
+
+	SpbContext->AsyncStatistics.Transactions++;
+	SpbContext->AsyncStatistics.RequestsReused++;
+	SpbContext->AsyncStatistics.BusTime += endTime - entry->StartTime;
+
+	if (entry->Operation.Read)
+	{
+		SpbContext->AsyncStatistics.BytesWritten += sizeof(entry->Operation.Address);
+		SpbContext->AsyncStatistics.BytesRead += entry->Operation.Length;
+		SpbContext->AsyncStatistics.BytesCopied += sizeof(entry->Operation.Address);
+
+		if (NT_SUCCESS(Status) &&
+			BytesTransferred != sizeof(entry->Operation.Address) + entry->Operation.Length)
+		{
+			Status = STATUS_IO_DEVICE_ERROR;
+		}
+
+		if (NT_SUCCESS(Status))
+		{
+			RtlCopyMemory(entry->Operation.Data, staging->Buffer, entry->Operation.Length);
+			SpbContext->AsyncStatistics.BytesCopied += entry->Operation.Length;
+		}
+
+		SpbTraceTransfer(
+			SpbContext,
+			SPB_TRACE_FLAG_ASYNC | SPB_TRACE_FLAG_READ,
+			entry->Operation.Address,
+			NT_SUCCESS(Status) ? staging->Buffer : NULL,
+			entry->Operation.Length,
+			entry->StartTime,
+			endTime,
+			Status);
+	}
+	else
+	{
+		SpbContext->AsyncStatistics.BytesWritten += entry->Operation.Length + 1;
+
+		//
+		// Staged once on submission and once more for the request
+		//
+		SpbContext->AsyncStatistics.BytesCopied += 2 * (entry->Operation.Length + 1);
+
+		if (NT_SUCCESS(Status) &&
+			BytesTransferred != entry->Operation.Length + 1)
+		{
+			Status = STATUS_IO_DEVICE_ERROR;
+		}
+
+		SpbTraceTransfer(
+			SpbContext,
+			SPB_TRACE_FLAG_ASYNC,
+			entry->Operation.Address,
+			&entry->WriteBuffer[1],
+			entry->Operation.Length,
+			entry->StartTime,
+			endTime,
+			Status);
+	}
+
+	do
+	{
+		entry = &SpbContext->AsyncQueue[SpbContext->AsyncHead];
+		last = entry->Last;
+
+		if (last || !NT_SUCCESS(Status))
+		{
+			completionRoutine = entry->CompletionRoutine;
+			context = entry->Context;
+		}
+
+		SpbContext->AsyncHead = (SpbContext->AsyncHead + 1) % SPB_ASYNC_QUEUE_DEPTH;
+		SpbContext->AsyncCount--;
+	} while (!NT_SUCCESS(Status) && !last);
+
+	WdfSpinLockRelease(SpbContext->AsyncLock);
+
+	if (!NT_SUCCESS(Status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Spb asynchronous operation failed - 0x%08lX",
+			Status);
+	}
+
+	if (completionRoutine != NULL)
+	{
+		completionRoutine(Status, context);
+	}
+}
+
+VOID
+SpbAsyncStartNext(
+	IN SPB_CONTEXT *SpbContext)
+/*++
+
+  Routine Description:
+
+	This helper routine sends the operation at the head of the
+	queue, or marks the queue idle when it is empty. Operations
+	that cannot be sent are retired with their error.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+
+  Return Value:
+
+	None
+
+--*/
+{
+	SPB_ASYNC_ENTRY *entry;
+	NTSTATUS status;
+
+	for (;;)
+	{
+		WdfSpinLockAcquire(SpbContext->AsyncLock);
+
+		if (SpbContext->AsyncCount == 0)
+		{
+			SpbContext->AsyncBusy = FALSE;
+			KeSetEvent(&SpbContext->AsyncIdleEvent, IO_NO_INCREMENT, FALSE);
+
+			WdfSpinLockRelease(SpbContext->AsyncLock);
+			return;
+		}
+
+		entry = &SpbContext->AsyncQueue[SpbContext->AsyncHead];
+
+		WdfSpinLockRelease(SpbContext->AsyncLock);
+
+		status = SpbAsyncSend(SpbContext, entry);
+
+		if (NT_SUCCESS(status))
+		{
+			return;
+		}
+
+		SpbAsyncComplete(SpbContext, status, 0);
+	}
+}
+
+VOID
+SpbAsyncCompletionRoutine(
+	IN WDFREQUEST Request,
+	IN WDFIOTARGET Target,
+	IN PWDF_REQUEST_COMPLETION_PARAMS Params,
+	IN WDFCONTEXT Context)
+/*++
+
+  Routine Description:
+
+	Completion routine of the asynchronous request, retires the
+	operation it carried and starts the next one.
+
+  Arguments:
+
+	Request - The asynchronous request
+	Target  - The Spb I/O target
+	Params  - Completion status of the request
+	Context - Pointer to the current device context
+
+  Return Value:
+
+	None
+
+--*/
+{
+	SPB_CONTEXT *spbContext = (SPB_CONTEXT *)Context;
+
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(Target);
+
+	SpbAsyncComplete(
+		spbContext,
+		Params->IoStatus.Status,
+		Params->IoStatus.Information);
+
+	SpbAsyncStartNext(spbContext);
+}
+
+NTSTATUS
+SpbSubmitAsynchronously(
+	IN SPB_CONTEXT *SpbContext,
+	IN PSPB_OPERATION Operations,
+	IN ULONG Count,
+	IN PSPB_COMPLETION_ROUTINE CompletionRoutine,
+	IN PVOID Context)
+/*++
+
+  Routine Description:
+
+	This routine queues one or more register operations on the Spb
+	I/O target without waiting for them. Operations are executed
+	in submission order, one at a time, after those submitted
+	before them.
+
+  Arguments:
+
+	SpbContext        - Pointer to the current device context
+	Operations        - The register operations to execute in order
+	Count             - Number of operations
+	CompletionRoutine - Called once the submission is done, with the
+	                    status of the failed operation or STATUS_SUCCESS
+	Context           - Passed to the completion routine
+
+  Return Value:
+
+	STATUS_SUCCESS if the operations were queued, the completion
+	routine is only called in that case. STATUS_DEVICE_BUSY if the
+	queue has no room for them.
+
+--*/
+{
+	SPB_ASYNC_ENTRY *entry;
+	NTSTATUS status;
+	BOOLEAN start = FALSE;
+	ULONG i;
+
+	if (SpbContext->AsyncRequest == NULL)
+	{
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	if (Count == 0 || Count > SPB_ASYNC_QUEUE_DEPTH || CompletionRoutine == NULL)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	for (i = 0; i < Count; i++)
+	{
+		if (Operations[i].Read
+				? (Operations[i].Length == 0 || Operations[i].Length > DEFAULT_SPB_BUFFER_SIZE)
+				: (Operations[i].Length > DEFAULT_SPB_BUFFER_SIZE - 1))
+		{
+			return STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	WdfSpinLockAcquire(SpbContext->AsyncLock);
+
+	if (SPB_ASYNC_QUEUE_DEPTH - SpbContext->AsyncCount < Count)
+	{
+		status = STATUS_DEVICE_BUSY;
+		goto exit;
+	}
+
+	for (i = 0; i < Count; i++)
+	{
+		entry = &SpbContext->AsyncQueue[(SpbContext->AsyncHead + SpbContext->AsyncCount + i) % SPB_ASYNC_QUEUE_DEPTH];
+
+		entry->Operation = Operations[i];
+		entry->CompletionRoutine = CompletionRoutine;
+		entry->Context = Context;
+		entry->Last = (i == Count - 1);
+
+		//
+		// Writes are staged with the address in front, the caller's
+		// buffer does not have to outlive this call
+		//
+		if (!entry->Operation.Read)
+		{
+			entry->WriteBuffer[0] = entry->Operation.Address;
+			RtlCopyMemory(
+				&entry->WriteBuffer[1],
+				entry->Operation.Data,
+				entry->Operation.Length);
+		}
+	}
+
+	SpbContext->AsyncCount += Count;
+
+	if (!SpbContext->AsyncBusy)
+	{
+		SpbContext->AsyncBusy = TRUE;
+		KeClearEvent(&SpbContext->AsyncIdleEvent);
+		start = TRUE;
+	}
+
+	status = STATUS_SUCCESS;
+
+exit:
+	WdfSpinLockRelease(SpbContext->AsyncLock);
+
+	if (start)
+	{
+		SpbAsyncStartNext(SpbContext);
+	}
+
+	return status;
+}
+
+VOID SpbGetStatistics(
+	IN SPB_CONTEXT *SpbContext,
+	OUT SPB_STATISTICS *Statistics)
+/*++
+
+  Routine Description:
+
+	This routine returns a consistent snapshot of the bus statistics
+	accumulated by the Spb I/O target so far, synchronous and
+	asynchronous transactions combined.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Statistics - Receives the transaction, byte and bus time counters
+
+  Return Value:
+
+	None
+
+--*/
+{
+	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+	*Statistics = SpbContext->Statistics;
+
+	if (SpbContext->AsyncLock != NULL)
+	{
+		WdfSpinLockAcquire(SpbContext->AsyncLock);
+
+		Statistics->Transactions += SpbContext->AsyncStatistics.Transactions;
+		Statistics->BytesWritten += SpbContext->AsyncStatistics.BytesWritten;
+		Statistics->BytesRead += SpbContext->AsyncStatistics.BytesRead;
+		Statistics->BusTime += SpbContext->AsyncStatistics.BusTime;
+		Statistics->RequestsReused += SpbContext->AsyncStatistics.RequestsReused;
+		Statistics->BytesCopied += SpbContext->AsyncStatistics.BytesCopied;
+
+		WdfSpinLockRelease(SpbContext->AsyncLock);
+	}
+
+	WdfWaitLockRelease(SpbContext->SpbLock);
+}
+
+BOOLEAN SpbGetTraceRecord(
+	IN SPB_CONTEXT *SpbContext,
+	IN ULONG Index,
+	OUT SPB_TRACE_RECORD *Record)
+/*++
+
+  Routine Description:
+
+	This routine copies one slot of the flight recorder without
+	holding up the bus, at any IRQL.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Index      - Slot to copy, below SPB_TRACE_RECORD_COUNT
+	Record     - Receives the record
+
+  Return Value:
+
+	FALSE if the slot is empty or was being written during the copy
+
+--*/
+{
+	SPB_TRACE_RECORD *record = &SpbContext->Trace[Index];
+	LONG sequence;
+
+	sequence = InterlockedCompareExchange(&record->Sequence, 0, 0);
+
+	RtlCopyMemory(Record, record, sizeof(SPB_TRACE_RECORD));
+
+	return sequence != 0 &&
+		   sequence == InterlockedCompareExchange(&record->Sequence, 0, 0);
+}
+
+ULONG SpbGetTraceSequence(
+	IN SPB_CONTEXT *SpbContext)
+/*++
+
+  Routine Description:
+
+	This routine returns the number of transfers appended to the
+	flight recorder so far.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+
+  Return Value:
+
+	Number of records appended, including those overwritten since
+
+--*/
+{
+	return (ULONG)InterlockedCompareExchange(&SpbContext->TraceNext, 0, 0);
+}
+
+VOID SpbTargetDeinitialize(
+	IN WDFDEVICE FxDevice,
+	IN SPB_CONTEXT *SpbContext)
+/*++
+
+  Routine Description:
+
+	This helper routine is used to free any members added to the SPB_CONTEXT,
+	note the SPB I/O target is parented to the device and will be
+	closed and free'd when the device is removed.
+
+  Arguments:
+
+	FxDevice   - Handle to the framework device object
+	SpbContext - Pointer to the current device context
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	UNREFERENCED_PARAMETER(FxDevice);
+
+	//
+	// Let queued asynchronous operations run to completion first, their
+	// completion path still takes the locks and touches the requests
+	// and memory freed below
+	//
+	SpbAsyncWaitForIdle(SpbContext);
+
+	//
+	// Free any SPB_CONTEXT allocations here
+	//
+	if (SpbContext->SpbLock != NULL)
+	{
+		WdfObjectDelete(SpbContext->SpbLock);
+	}
+
+	if (SpbContext->AsyncRequest != NULL)
+	{
+		WdfObjectDelete(SpbContext->AsyncRequest);
+		SpbContext->AsyncRequest = NULL;
+	}
+
+	if (SpbContext->AsyncMemory != NULL)
+	{
+		WdfObjectDelete(SpbContext->AsyncMemory);
+		SpbContext->AsyncMemory = NULL;
+	}
+
+	if (SpbContext->AsyncLock != NULL)
+	{
+		WdfObjectDelete(SpbContext->AsyncLock);
+		SpbContext->AsyncLock = NULL;
+	}
+
+	if (SpbContext->ReadRequest != NULL)
+	{
+		WdfObjectDelete(SpbContext->ReadRequest);
+		SpbContext->ReadRequest = NULL;
+	}
+
+	if (SpbContext->WriteRequest != NULL)
+	{
+		WdfObjectDelete(SpbContext->WriteRequest);
+		SpbContext->WriteRequest = NULL;
+	}
+
+	if (SpbContext->ReadMemory != NULL)
+	{
+		WdfObjectDelete(SpbContext->ReadMemory);
+	}
+
+	if (SpbContext->WriteMemory != NULL)
+	{
+		WdfObjectDelete(SpbContext->WriteMemory);
+	}
+}
+
+NTSTATUS
+SpbTargetInitialize(
+	IN WDFDEVICE FxDevice,
+	IN SPB_CONTEXT *SpbContext)
+/*++
+
+  Routine Description:
+
+	This helper routine opens the Spb I/O target and
+	initializes the write and read request objects used for the
+	lifetime of communication between this driver and Spb.
+
+  Arguments:
+
+	FxDevice   - Handle to the framework device object
+	SpbContext - Pointer to the current device context
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	WDF_OBJECT_ATTRIBUTES objectAttributes;
+	WDF_IO_TARGET_OPEN_PARAMS openParams;
+	UNICODE_STRING spbDeviceName;
+	WCHAR spbDeviceNameBuffer[RESOURCE_HUB_PATH_SIZE];
+	NTSTATUS status;
+
+	RtlZeroMemory(&SpbContext->Statistics, sizeof(SpbContext->Statistics));
+	SpbContext->WriteRequest = NULL;
+	SpbContext->ReadRequest = NULL;
+	SpbContext->AsyncRequest = NULL;
+	SpbContext->AsyncMemory = NULL;
+	SpbContext->AsyncLock = NULL;
+	SpbContext->AsyncHead = 0;
+	SpbContext->AsyncCount = 0;
+	SpbContext->AsyncBusy = FALSE;
+	RtlZeroMemory(&SpbContext->AsyncStatistics, sizeof(SpbContext->AsyncStatistics));
+	KeInitializeEvent(&SpbContext->AsyncIdleEvent, NotificationEvent, TRUE);
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
+	objectAttributes.ParentObject = FxDevice;
+
+	status = WdfIoTargetCreate(
+		FxDevice,
+		&objectAttributes,
+		&SpbContext->SpbIoTarget);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error creating IoTarget object - 0x%08lX",
+			status);
+
+		WdfObjectDelete(SpbContext->SpbIoTarget);
+		goto exit;
+	}
+
+	RtlInitEmptyUnicodeString(
+		&spbDeviceName,
+		spbDeviceNameBuffer,
+		sizeof(spbDeviceNameBuffer));
+
+	status = RESOURCE_HUB_CREATE_PATH_FROM_ID(
+		&spbDeviceName,
+		SpbContext->I2cResHubId.LowPart,
+		SpbContext->I2cResHubId.HighPart);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error creating Spb resource hub path string - 0x%08lX",
+			status);
+		goto exit;
+	}
+
+	WDF_IO_TARGET_OPEN_PARAMS_INIT_OPEN_BY_NAME(
+		&openParams,
+		&spbDeviceName,
 		(GENERIC_READ | GENERIC_WRITE));
 
 	openParams.ShareAccess = 0;
@@ -507,6 +1554,100 @@ SpbTargetInitialize(
 		goto exit;
 	}
 
+	//
+	// Preallocate the requests every transaction is sent on, so the
+	// framework does not create and free one per register access
+	//
+	WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
+	objectAttributes.ParentObject = SpbContext->SpbIoTarget;
+
+	status = WdfRequestCreate(
+		&objectAttributes,
+		SpbContext->SpbIoTarget,
+		&SpbContext->WriteRequest);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error allocating Spb write request - 0x%08lX",
+			status);
+		goto exit;
+	}
+
+	SpbContext->Statistics.RequestsAllocated++;
+
+	status = WdfRequestCreate(
+		&objectAttributes,
+		SpbContext->SpbIoTarget,
+		&SpbContext->ReadRequest);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error allocating Spb read request - 0x%08lX",
+			status);
+		goto exit;
+	}
+
+	SpbContext->Statistics.RequestsAllocated++;
+
+	//
+	// Asynchronous operations run on their own request and staging
+	// buffer, one at a time
+	//
+	status = WdfRequestCreate(
+		&objectAttributes,
+		SpbContext->SpbIoTarget,
+		&SpbContext->AsyncRequest);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error allocating Spb asynchronous request - 0x%08lX",
+			status);
+		goto exit;
+	}
+
+	SpbContext->Statistics.RequestsAllocated++;
+
+	status = WdfMemoryCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		NonPagedPool,
+		SPB_POOL_TAG,
+		sizeof(SPB_ASYNC_STAGING),
+		&SpbContext->AsyncMemory,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error allocating Spb asynchronous staging buffer - 0x%08lX",
+			status);
+		goto exit;
+	}
+
+	status = WdfSpinLockCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&SpbContext->AsyncLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error creating Spb asynchronous queue lock - 0x%08lX",
+			status);
+		goto exit;
+	}
+
 	//
 	// Allocate a waitlock to guard access to the default buffers
 	//
@@ -27,6 +27,122 @@
 
 #define SPB_POOL_TAG 'bpSH'
 
+//
+// SPB (I2C) bus statistics, BusTime is in performance counter ticks.
+// RequestsAllocated counts request objects created for the target,
+// RequestsReused the transactions sent on one of them. BytesCopied
+// counts bytes staged through the driver's own buffers, ZeroCopyBytes
+// payload bytes transferred straight from the caller's buffer.
+//
+
+typedef struct _SPB_STATISTICS
+{
+	ULONG Transactions;
+	ULONG BytesWritten;
+	ULONG BytesRead;
+	LONGLONG BusTime;
+	ULONG RequestsAllocated;
+	ULONG RequestsReused;
+	ULONG BytesCopied;
+	ULONG ZeroCopyBytes;
+} SPB_STATISTICS;
+
+//
+// SPB (I2C) flight recorder
+//
+// Every transfer leaves a binary record in a fixed ring holding the last
+// SPB_TRACE_RECORD_COUNT of them, whichever path issued it. A batch leaves
+// one record per write or read step. Appending claims a slot with a
+// single interlocked increment of TraceNext and stores the slot's
+// Sequence (claim number + 1) last, so records are appended at any IRQL
+// without a lock and read back while the bus is running, see
+// SpbGetTraceRecord. StartTime and Duration are in performance counter
+// ticks, Data holds the first SPB_TRACE_DATA_BYTES bytes transferred.
+//
+
+#define SPB_TRACE_RECORD_COUNT 256
+#define SPB_TRACE_DATA_BYTES 4
+
+#define SPB_TRACE_FLAG_READ 0x01
+#define SPB_TRACE_FLAG_BATCH 0x02
+#define SPB_TRACE_FLAG_ASYNC 0x04
+
+typedef struct _SPB_TRACE_RECORD
+{
+	volatile LONG Sequence;
+	UCHAR Flags;
+	UCHAR Address;
+	USHORT Length;
+	LONGLONG StartTime;
+	ULONG Duration;
+	NTSTATUS Status;
+	UCHAR Data[SPB_TRACE_DATA_BYTES];
+} SPB_TRACE_RECORD;
+
+//
+// Batched SPB (I2C) steps, executed as a single Spb sequence. A delay is
+// carried out by the controller before the transfer of the next step,
+// so a batch cannot end with one. Writes and read register addresses
+// share DEFAULT_SPB_BUFFER_SIZE bytes, reads another
+// DEFAULT_SPB_BUFFER_SIZE bytes.
+//
+
+#define SPB_BATCH_MAX_TRANSFERS 8
+
+typedef enum _SPB_BATCH_STEP_TYPE
+{
+	SpbBatchStepWrite,
+	SpbBatchStepRead,
+	SpbBatchStepDelay
+} SPB_BATCH_STEP_TYPE;
+
+typedef struct _SPB_BATCH_STEP
+{
+	SPB_BATCH_STEP_TYPE Type;
+	UCHAR Address;
+	ULONG Length;
+	PVOID Data;
+	ULONG DelayUs;
+} SPB_BATCH_STEP, *PSPB_BATCH_STEP;
+
+//
+// Asynchronous SPB (I2C) operations
+//
+// A submission is one or more register operations executed in order, one
+// bus transaction each. Its completion routine runs once, after the last
+// operation or after the first one that failed, at IRQL <= DISPATCH_LEVEL.
+// Write data is copied on submission, the Data buffer of a read has to
+// stay resident until the completion routine runs. Submissions on one
+// context are executed in submission order, a synchronous transfer waits
+// for those submitted before it.
+//
+
+#define SPB_ASYNC_QUEUE_DEPTH 16
+
+typedef VOID SPB_COMPLETION_ROUTINE(
+	_In_ NTSTATUS Status,
+	_In_opt_ PVOID Context);
+
+typedef SPB_COMPLETION_ROUTINE *PSPB_COMPLETION_ROUTINE;
+
+typedef struct _SPB_OPERATION
+{
+	BOOLEAN Read;
+	UCHAR Address;
+	ULONG Length;
+	PVOID Data;
+} SPB_OPERATION, *PSPB_OPERATION;
+
+typedef struct _SPB_ASYNC_ENTRY
+{
+	SPB_OPERATION Operation;
+	UCHAR WriteBuffer[DEFAULT_SPB_BUFFER_SIZE];
+	PSPB_COMPLETION_ROUTINE CompletionRoutine;
+	PVOID Context;
+	BOOLEAN Last;
+	LONGLONG StartTime;
+} SPB_ASYNC_ENTRY;
+
 //
 // SPB (I2C) context
 //
@@ -37,9 +153,38 @@ typedef struct _SPB_CONTEXT
 	LARGE_INTEGER I2cResHubId;
 	WDFMEMORY WriteMemory;
 	WDFMEMORY ReadMemory;
+	WDFREQUEST WriteRequest;
+	WDFREQUEST ReadRequest;
 	WDFWAITLOCK SpbLock;
+	SPB_STATISTICS Statistics;
+
+	//
+	// Asynchronous operations, a ring of pending entries guarded by
+	// AsyncLock with the one at AsyncHead in flight on AsyncRequest
+	//
+	WDFREQUEST AsyncRequest;
+	WDFMEMORY AsyncMemory;
+	WDFSPINLOCK AsyncLock;
+	SPB_ASYNC_ENTRY AsyncQueue[SPB_ASYNC_QUEUE_DEPTH];
+	ULONG AsyncHead;
+	ULONG AsyncCount;
+	BOOLEAN AsyncBusy;
+	KEVENT AsyncIdleEvent;
+	SPB_STATISTICS AsyncStatistics;
+
+	//
+	// Flight recorder, kept across restarts of the target
+	//
+	volatile LONG TraceNext;
+	SPB_TRACE_RECORD Trace[SPB_TRACE_RECORD_COUNT];
 } SPB_CONTEXT;
 
+NTSTATUS
+SpbExecuteBatch(
+	IN SPB_CONTEXT *SpbContext,
+	IN PSPB_BATCH_STEP Steps,
+	IN ULONG Count);
+
 NTSTATUS
 SpbReadDataSynchronously(
 	_In_ SPB_CONTEXT *SpbContext,
@@ -47,6 +192,26 @@ SpbReadDataSynchronously(
 	_In_reads_bytes_(Length) PVOID Data,
 	_In_ ULONG Length);
 
+NTSTATUS
+SpbSubmitAsynchronously(
+	IN SPB_CONTEXT *SpbContext,
+	IN PSPB_OPERATION Operations,
+	IN ULONG Count,
+	IN PSPB_COMPLETION_ROUTINE CompletionRoutine,
+	IN PVOID Context);
+
+VOID SpbGetStatistics(
+	IN SPB_CONTEXT *SpbContext,
+	OUT SPB_STATISTICS *Statistics);
+
+BOOLEAN SpbGetTraceRecord(
+	IN SPB_CONTEXT *SpbContext,
+	IN ULONG Index,
+	OUT SPB_TRACE_RECORD *Record);
+
+ULONG SpbGetTraceSequence(
+	IN SPB_CONTEXT *SpbContext);
+
 VOID SpbTargetDeinitialize(
 	IN WDFDEVICE FxDevice,
 	IN SPB_CONTEXT *SpbContext);
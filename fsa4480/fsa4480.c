@@ -1,330 +1,1579 @@
 #include "fsa4480.h"
-#include "Driver.h"
+
+#ifndef FSA4480_HOST
+#include "trace.h"
+#include "events.h"
 #include "fsa4480.tmh"
+#endif
+
+VOID
+FSA4480_InvalidateRegisterCache(
+	PFSA4480_CHIP Chip)
+{
+	Chip->RegisterCache.ValidMask = 0;
+}
+
+BOOLEAN
+FSA4480_IsRegisterCached(
+	PFSA4480_REGISTER_CACHE RegisterCache,
+	BYTE Address,
+	BYTE Value)
+{
+	if (FSA4480_IS_VOLATILE_REGISTER(Address) ||
+		(RegisterCache->ValidMask & (1UL << Address)) == 0)
+	{
+		return FALSE;
+	}
+
+	return RegisterCache->Values[Address] == Value;
+}
+
+BOOLEAN
+FSA4480_AreRegistersCached(
+	PFSA4480_REGISTER_CACHE RegisterCache,
+	BYTE Address,
+	BYTE *Values,
+	ULONG Count)
+{
+	ULONG i;
+
+	for (i = 0; i < Count; i++)
+	{
+		if (!FSA4480_IsRegisterCached(RegisterCache, (BYTE)(Address + i), Values[i]))
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+VOID
+FSA4480_UpdateRegisterCache(
+	PFSA4480_REGISTER_CACHE RegisterCache,
+	BYTE Address,
+	BYTE *Values,
+	ULONG Count,
+	NTSTATUS WriteStatus)
+{
+	ULONG i;
+
+	for (i = 0; i < Count; i++)
+	{
+		BYTE registerAddress = (BYTE)(Address + i);
+
+		if (!NT_SUCCESS(WriteStatus) || FSA4480_IS_VOLATILE_REGISTER(registerAddress))
+		{
+			//
+			// The chip may or may not have latched the value, forget it
+			//
+			RegisterCache->ValidMask &= ~(1UL << registerAddress);
+		}
+		else
+		{
+			RegisterCache->Values[registerAddress] = Values[i];
+			RegisterCache->ValidMask |= (1UL << registerAddress);
+		}
+	}
+}
+
+NTSTATUS
+FSA4480_WriteRegisters(
+	PFSA4480_CHIP Chip,
+	BYTE Address,
+	BYTE *Values,
+	ULONG Count)
+{
+	NTSTATUS status;
+	PFSA4480_REGISTER_CACHE registerCache;
+	BOOLEAN traced;
+	LONGLONG startTime = 0;
+	registerCache = &Chip->RegisterCache;
+
+	if (Count == 0 || Address + Count > FSA4480_REGISTER_COUNT)
+	{
+		status = STATUS_INVALID_PARAMETER;
+		goto exit;
+	}
+
+	if (FSA4480_AreRegistersCached(registerCache, Address, Values, Count))
+	{
+		registerCache->WritesSkipped++;
+		status = STATUS_SUCCESS;
+		goto exit;
+	}
+
+	registerCache->WritesIssued++;
+
+	traced = FSA4480_EVENTS_ENABLED(FSA4480_EVENT_KEYWORD_REGISTER);
+
+	if (traced)
+	{
+		startTime = Chip->Bus.QueryTime(Chip->Bus.Context);
+	}
+
+	//
+	// The chip auto-increments the register address, so a run of adjacent
+	// registers goes out as a single transaction.
+	//
+	status = Chip->Bus.Write(
+		Chip->Bus.Context,
+		Address,
+		Values,
+		Count);
+
+	if (traced)
+	{
+		FSA4480_EVENT_REGISTER_WRITE(
+			Address,
+			Values,
+			Count,
+			FALSE,
+			status,
+			Chip->Bus.QueryTime(Chip->Bus.Context) - startTime);
+	}
+
+	FSA4480_UpdateRegisterCache(registerCache, Address, Values, Count, status);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error writing %d register(s) at 0x%02X - %!STATUS!",
+			Count,
+			Address,
+			status);
+
+		goto exit;
+	}
+
+exit:
+	return status;
+}
+
+NTSTATUS
+FSA4480_WriteRegister(
+	PFSA4480_CHIP Chip,
+	BYTE Address,
+	BYTE Value)
+{
+	return FSA4480_WriteRegisters(Chip, Address, &Value, 1);
+}
+
+NTSTATUS
+FSA4480_ReadRegister(
+	PFSA4480_CHIP Chip,
+	BYTE Address,
+	BYTE *Value)
+{
+	NTSTATUS status;
+	PFSA4480_REGISTER_CACHE registerCache;
+	BOOLEAN traced;
+	LONGLONG startTime = 0;
+	registerCache = &Chip->RegisterCache;
+
+	if (!FSA4480_IS_VOLATILE_REGISTER(Address) &&
+		(registerCache->ValidMask & (1UL << Address)) != 0)
+	{
+		registerCache->ReadsServed++;
+		*Value = registerCache->Values[Address];
+		status = STATUS_SUCCESS;
+		goto exit;
+	}
+
+	registerCache->ReadsIssued++;
+
+	traced = FSA4480_EVENTS_ENABLED(FSA4480_EVENT_KEYWORD_STATUS);
+
+	if (traced)
+	{
+		startTime = Chip->Bus.QueryTime(Chip->Bus.Context);
+	}
+
+	status = Chip->Bus.Read(
+		Chip->Bus.Context,
+		Address,
+		Value,
+		1);
+
+	if (traced)
+	{
+		FSA4480_EVENT_STATUS_READ(
+			Address,
+			NT_SUCCESS(status) ? *Value : 0,
+			FALSE,
+			status,
+			Chip->Bus.QueryTime(Chip->Bus.Context) - startTime);
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error reading register 0x%02X - %!STATUS!",
+			Address,
+			status);
+
+		goto exit;
+	}
+
+	if (!FSA4480_IS_VOLATILE_REGISTER(Address))
+	{
+		registerCache->Values[Address] = *Value;
+		registerCache->ValidMask |= (1UL << Address);
+	}
+
+exit:
+	return status;
+}
+
+VOID
+FSA4480_BeginSwitchTiming(
+	PFSA4480_CHIP Chip,
+	FSA4480_LATENCY_SOURCE Source,
+	LONGLONG StartTime)
+{
+	RtlZeroMemory(&Chip->SwitchTiming, sizeof(Chip->SwitchTiming));
+
+	Chip->SwitchTiming.Source = Source;
+	Chip->SwitchTiming.StartTime =
+		StartTime != 0 ? StartTime : Chip->Bus.QueryTime(Chip->Bus.Context);
+}
+
+VOID
+FSA4480_MarkSwitchStage(
+	PFSA4480_CHIP Chip,
+	FSA4480_LATENCY_STAGE Stage)
+{
+	if (Chip->SwitchTiming.StartTime != 0)
+	{
+		Chip->SwitchTiming.StageTimes[Stage] = Chip->Bus.QueryTime(Chip->Bus.Context);
+	}
+}
+
+VOID
+FSA4480_RecordLatency(
+	PFSA4480_LATENCY_HISTOGRAM Histogram,
+	ULONG Microseconds)
+{
+	ULONG bucket = 0;
+	LONG maxUs;
+
+	while (bucket < FSA4480_LATENCY_BUCKET_COUNT - 1 &&
+		   (1UL << bucket) <= Microseconds)
+	{
+		bucket++;
+	}
+
+	//
+	// Histograms are read by the diagnostics path while being updated, keep
+	// every counter update atomic instead of serializing the switch path
+	//
+	InterlockedIncrement((volatile LONG *)&Histogram->Buckets[bucket]);
+	InterlockedIncrement((volatile LONG *)&Histogram->Count);
+
+	do
+	{
+		maxUs = (LONG)Histogram->MaxUs;
+		if ((ULONG)maxUs >= Microseconds)
+		{
+			break;
+		}
+	} while (InterlockedCompareExchange(
+				 (volatile LONG *)&Histogram->MaxUs,
+				 (LONG)Microseconds,
+				 maxUs) != maxUs);
+}
+
+VOID
+FSA4480_EndSwitchTiming(
+	PFSA4480_CHIP Chip,
+	FSA4480_LATENCY_MODE Mode)
+{
+	PFSA4480_SWITCH_TIMING switchTiming;
+	LONGLONG elapsed;
+	ULONG elapsedUs;
+	ULONG stage;
+	switchTiming = &Chip->SwitchTiming;
+
+	if (switchTiming->StartTime == 0)
+	{
+		return;
+	}
+
+	FSA4480_MarkSwitchStage(Chip, FSA4480_LATENCY_STAGE_COMPLETE);
+
+	if (Mode < FSA4480_LATENCY_MODE_COUNT)
+	{
+		for (stage = 0; stage < FSA4480_LATENCY_STAGE_COUNT; stage++)
+		{
+			//
+			// Stages skipped because the chip already held the settings
+			// completed together with the switch
+			//
+			if (switchTiming->StageTimes[stage] == 0)
+			{
+				switchTiming->StageTimes[stage] =
+					switchTiming->StageTimes[FSA4480_LATENCY_STAGE_COMPLETE];
+			}
+
+			elapsed = switchTiming->StageTimes[stage] - switchTiming->StartTime;
+			elapsedUs = (ULONG)(elapsed * 1000000 / Chip->Bus.TimeFrequency);
+
+			FSA4480_RecordLatency(
+				&Chip->SwitchLatency.Histograms[Mode][stage],
+				elapsedUs);
+
+			if (switchTiming->Source < FSA4480_LATENCY_SOURCE_COUNT)
+			{
+				FSA4480_RecordLatency(
+					&Chip->SwitchLatency.Sources[switchTiming->Source][stage],
+					elapsedUs);
+			}
+		}
+	}
+
+	switchTiming->StartTime = 0;
+}
+
+VOID
+FSA4480_GetSwitchLatency(
+	PFSA4480_CHIP Chip,
+	PFSA4480_SWITCH_LATENCY SwitchLatency)
+{
+	RtlCopyMemory(SwitchLatency, &Chip->SwitchLatency, sizeof(FSA4480_SWITCH_LATENCY));
+
+	SwitchLatency->Version = FSA4480_LATENCY_VERSION;
+}
+
+VOID
+FSA4480_PublishState(
+	PFSA4480_CHIP Chip)
+{
+	PFSA4480_PUBLISHED_STATE publishedState = &Chip->PublishedState;
+	PFSA4480_STATE_SNAPSHOT slot;
+	LONG sequence = publishedState->Sequence;
+
+	//
+	// Readers are on the other slot until Sequence is incremented, the
+	// increment is a full barrier and publishes the slot contents with it
+	//
+	slot = &publishedState->Slots[(sequence + 1) & 1];
+
+	slot->Version = FSA4480_STATE_SNAPSHOT_VERSION;
+	slot->Generation = (ULONG)sequence + 1;
+	slot->State = Chip->State;
+	slot->Orientation = Chip->Orientation;
+	slot->Partner = Chip->USBCPartner;
+	slot->Profile = Chip->ActiveProfile;
+	slot->RecoveryAttempts = Chip->Recovery.Attempts;
+	slot->RecoverySucceeded = Chip->Recovery.Succeeded;
+	slot->RecoverySuppressed = Chip->Recovery.Suppressed;
+	slot->RegisterValidMask = Chip->RegisterCache.ValidMask;
+
+	RtlCopyMemory(
+		slot->Registers,
+		Chip->RegisterCache.Values,
+		sizeof(slot->Registers));
+
+	InterlockedIncrement(&publishedState->Sequence);
+}
+
+VOID
+FSA4480_ReadState(
+	PFSA4480_CHIP Chip,
+	PFSA4480_STATE_SNAPSHOT Snapshot)
+{
+	PFSA4480_PUBLISHED_STATE publishedState = &Chip->PublishedState;
+	LONG sequence;
+
+	//
+	// The slot can only be overwritten if the writer published twice
+	// during the copy, Sequence has moved then
+	//
+	do
+	{
+		sequence = InterlockedCompareExchange(&publishedState->Sequence, 0, 0);
+
+		RtlCopyMemory(
+			Snapshot,
+			&publishedState->Slots[sequence & 1],
+			sizeof(FSA4480_STATE_SNAPSHOT));
+
+	} while (sequence != InterlockedCompareExchange(&publishedState->Sequence, 0, 0));
+
+	Snapshot->Version = FSA4480_STATE_SNAPSHOT_VERSION;
+}
+
+BOOLEAN
+FSA4480_BeginRegisterDump(
+	PFSA4480_CHIP Chip,
+	BOOLEAN Powered,
+	PFSA4480_REGISTER_DUMP Dump)
+{
+	PFSA4480_REGISTER_CACHE registerCache;
+	ULONG address;
+	registerCache = &Chip->RegisterCache;
+
+	RtlZeroMemory(Dump, sizeof(*Dump));
+
+	Dump->Version = FSA4480_REGISTER_DUMP_VERSION;
+	Dump->Status = STATUS_DEVICE_POWERED_OFF;
+	Dump->State = Chip->State;
+	Dump->Frequency = Chip->Bus.TimeFrequency;
+
+	//
+	// Volatile registers are never cached, so they are never expected
+	//
+	Dump->ExpectedValidMask = registerCache->ValidMask;
+
+	for (address = 0; address < FSA4480_REGISTER_COUNT; address++)
+	{
+		if (registerCache->ValidMask & (1UL << address))
+		{
+			Dump->Expected[address] = registerCache->Values[address];
+		}
+	}
+
+	if (!Powered)
+	{
+		return FALSE;
+	}
+
+	//
+	// The chip auto-increments the register address, the whole register
+	// file comes back in a single transaction. The cache is left alone,
+	// a mismatch has to show up here rather than be papered over.
+	//
+	registerCache->ReadsIssued++;
+
+	return TRUE;
+}
+
+NTSTATUS
+FSA4480_DumpRegisters(
+	PFSA4480_CHIP Chip,
+	BOOLEAN Powered,
+	PFSA4480_REGISTER_DUMP Dump)
+{
+	NTSTATUS status;
+
+	if (!FSA4480_BeginRegisterDump(Chip, Powered, Dump))
+	{
+		return STATUS_DEVICE_POWERED_OFF;
+	}
+
+	status = Chip->Bus.Read(
+		Chip->Bus.Context,
+		0x00,
+		Dump->Registers,
+		FSA4480_REGISTER_COUNT);
+
+	FSA4480_CompleteRegisterDump(
+		Dump,
+		status,
+		Chip->Bus.QueryTime(Chip->Bus.Context));
+
+	return status;
+}
+
+VOID
+FSA4480_CompleteRegisterDump(
+	PFSA4480_REGISTER_DUMP Dump,
+	NTSTATUS ReadStatus,
+	LONGLONG Timestamp)
+{
+	ULONG address;
+
+	Dump->Timestamp = Timestamp;
+	Dump->Status = ReadStatus;
+
+	if (!NT_SUCCESS(ReadStatus))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error reading the register file - %!STATUS!",
+			ReadStatus);
+
+		RtlZeroMemory(Dump->Registers, sizeof(Dump->Registers));
+		return;
+	}
+
+	for (address = 0; address < FSA4480_REGISTER_COUNT; address++)
+	{
+		if ((Dump->ExpectedValidMask & (1UL << address)) != 0 &&
+			Dump->Registers[address] != Dump->Expected[address])
+		{
+			Dump->MismatchMask |= (1UL << address);
+		}
+	}
+
+	if (Dump->MismatchMask != 0)
+	{
+		TraceEvents(
+			TRACE_LEVEL_WARNING,
+			TRACE_DRIVER,
+			"Register file differs from the expected image, mask 0x%08X",
+			Dump->MismatchMask);
+	}
+}
+
+VOID
+FSA4480_RecordSettleDelay(
+	PFSA4480_CHIP Chip,
+	ULONG RequestedUs,
+	NTSTATUS Status,
+	LONGLONG ElapsedTicks,
+	BOOLEAN Batched)
+{
+	PFSA4480_SETTLE_DELAY settleDelay;
+	ULONG actualUs;
+	settleDelay = &Chip->SettleDelay;
+
+	FSA4480_EVENT_DELAY(RequestedUs, Batched, Status, ElapsedTicks);
+
+	if (!NT_SUCCESS(Status))
+	{
+		return;
+	}
+
+	actualUs = (ULONG)(ElapsedTicks * 1000000 / Chip->Bus.TimeFrequency);
+
+	settleDelay->LastRequestedUs = RequestedUs;
+	settleDelay->LastActualUs = actualUs;
+	settleDelay->LastBatched = Batched;
+
+	if (Batched)
+	{
+		if (actualUs > settleDelay->MaxBatchedUs)
+		{
+			settleDelay->MaxBatchedUs = actualUs;
+		}
+	}
+	else if (actualUs > settleDelay->MaxActualUs)
+	{
+		settleDelay->MaxActualUs = actualUs;
+	}
+
+	TraceEvents(
+		TRACE_LEVEL_VERBOSE,
+		TRACE_DRIVER,
+		"Delay requested %d us, got %d us%s",
+		RequestedUs,
+		actualUs,
+		Batched ? " (whole batch)" : "");
+}
+
+NTSTATUS
+FSA4480_Delay(
+	PFSA4480_CHIP Chip,
+	ULONG Microseconds)
+{
+	NTSTATUS status;
+	LONGLONG startTime, endTime;
+
+	startTime = Chip->Bus.QueryTime(Chip->Bus.Context);
+
+	status = Chip->Bus.Delay(Chip->Bus.Context, Microseconds);
+
+	endTime = Chip->Bus.QueryTime(Chip->Bus.Context);
+
+	FSA4480_RecordSettleDelay(
+		Chip,
+		Microseconds,
+		status,
+		endTime - startTime,
+		FALSE);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Delay of %d us failed with Status = 0x%08lX\n",
+			Microseconds,
+			status);
+	}
+
+	return status;
+}
+
+//
+// Register image of every switch state. SWITCH_SETTINGS always keeps the
+// device enabled, bits 3-4 carry D+/D-, bits 5-6 SBU1/SBU2 and bits 0-2
+// the audio MIC, SENSE and AGND switches.
+//
+static const FSA4480_STATE_DESCRIPTOR gStateTable[FSA4480_STATE_COUNT] =
+	{
+		// USB_SAFE: D+/D- to USB, SBU open
+		{0x18, 0x98, FALSE, FSA4480_PROFILE_USAGE_USB},
+		// DP_CC1: D+/D- to USB, SBU1/SBU2 to AUX straight
+		{0x18, 0xF8, TRUE, FSA4480_PROFILE_USAGE_DISPLAYPORT},
+		// DP_CC2: D+/D- to USB, SBU1/SBU2 to AUX crossed
+		{0x78, 0xF8, TRUE, FSA4480_PROFILE_USAGE_DISPLAYPORT},
+		// AUDIO_ACCESSORY: D+/D- to L/R, MIC, SENSE and AGND enabled
+		{0x00, 0x9F, FALSE, FSA4480_PROFILE_USAGE_AUDIO_ACCESSORY},
+		// AUDIO_MIC_GND_SWAPPED: as above with MIC and AGND exchanged
+		{0x07, 0x9F, FALSE, FSA4480_PROFILE_USAGE_AUDIO_ACCESSORY},
+};
+
+//
+// Built-in profiles, SLOW_L, SLOW_R, SLOW_MIC, SLOW_SENSE, SLOW_GND,
+// DELAY_L_R, DELAY_L_MIC, DELAY_L_SENSE and DELAY_L_AGND. BALANCED holds
+// the values the driver always used to program.
+//
+static const BYTE gDefaultProfiles[FSA4480_PROFILE_COUNT][FSA4480_PROFILE_REGISTER_COUNT] =
+	{
+		// FAST: no slow turn-on, no stagger
+		{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+		// BALANCED: AGND closes after L
+		{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09},
+		// QUIET: ramped turn-on, AGND closes after L. The datasheet gives
+		// no figure for the SLOW_* rates, 0x08 is a placeholder that has
+		// not been characterized for pop suppression.
+		{0x08, 0x08, 0x08, 0x08, 0x08, 0x00, 0x00, 0x00, 0x09},
+};
+
+VOID
+FSA4480_InitializeProfiles(
+	PFSA4480_PROFILE_TABLE ProfileTable)
+{
+	RtlCopyMemory(ProfileTable->Profiles, gDefaultProfiles, sizeof(ProfileTable->Profiles));
+
+	//
+	// Every usage keeps the register image the driver always programmed,
+	// FAST and QUIET are only used when the device hardware key selects
+	// them
+	//
+	ProfileTable->Selection[FSA4480_PROFILE_USAGE_USB] = FSA4480_PROFILE_BALANCED;
+	ProfileTable->Selection[FSA4480_PROFILE_USAGE_DISPLAYPORT] = FSA4480_PROFILE_BALANCED;
+	ProfileTable->Selection[FSA4480_PROFILE_USAGE_AUDIO_ACCESSORY] = FSA4480_PROFILE_BALANCED;
+}
+
+VOID
+FSA4480_BuildTransitionProgram(
+	FSA4480_STATE From,
+	FSA4480_STATE To,
+	PFSA4480_TRANSITION_PROGRAM Program)
+{
+	const FSA4480_STATE_DESCRIPTOR *target = &gStateTable[To];
+	PFSA4480_STEP step;
+	BYTE fromSettings;
+	BYTE changed;
+	BYTE closing;
+	BYTE intermediate;
+
+	RtlZeroMemory(Program, sizeof(*Program));
+
+	if (From == To)
+	{
+		return;
+	}
+
+	if (From == FSA4480_STATE_UNKNOWN)
+	{
+		//
+		// Nothing is known about the chip, assume every switch is enabled
+		// and has to be rerouted
+		//
+		fromSettings = FSA4480_SETTINGS_DEVICE_ENABLE | FSA4480_SWITCH_MASK;
+		changed = FSA4480_SWITCH_MASK;
+	}
+	else
+	{
+		fromSettings = gStateTable[From].SwitchSettings;
+		changed = (gStateTable[From].SwitchControl ^ target->SwitchControl) & FSA4480_SWITCH_MASK;
+	}
+
+	step = &Program->Steps[Program->StepCount++];
+	step->Type = FSA4480_STEP_WRITE;
+
+	if (changed == 0)
+	{
+		//
+		// Same routing, switches are only enabled or disabled
+		//
+		step->Address = FSA4480_SWITCH_SETTINGS;
+		step->Count = 1;
+		step->Values[0] = target->SwitchSettings;
+		return;
+	}
+
+	//
+	// Rerouted switches the target enables stay open until the new routing
+	// has settled. Every other switch goes to its target state right away,
+	// which also opens rerouted switches the target disables before
+	// SWITCH_CONTROL changes underneath them.
+	//
+	closing = changed & target->SwitchSettings;
+	intermediate = target->SwitchSettings & ~closing;
+
+	if (intermediate == fromSettings)
+	{
+		step->Address = FSA4480_SWITCH_CONTROL;
+		step->Count = 1;
+		step->Values[0] = target->SwitchControl;
+	}
+	else
+	{
+		//
+		// SWITCH_SETTINGS and SWITCH_CONTROL are adjacent, the chip latches
+		// the burst in address order
+		//
+		step->Address = FSA4480_SWITCH_SETTINGS;
+		step->Count = 2;
+		step->Values[0] = intermediate;
+		step->Values[1] = target->SwitchControl;
+	}
+
+	if (closing == 0)
+	{
+		return;
+	}
+
+	step = &Program->Steps[Program->StepCount++];
+	step->Type = FSA4480_STEP_SETTLE;
+	step->DelayUs = FSA4480_SWITCH_SETTLE_US;
+
+	step = &Program->Steps[Program->StepCount++];
+	step->Type = FSA4480_STEP_WRITE;
+	step->Address = FSA4480_SWITCH_SETTINGS;
+	step->Count = 1;
+	step->Values[0] = target->SwitchSettings;
+}
+
+VOID
+FSA4480_BuildTransitionPrograms(
+	PFSA4480_CHIP Chip)
+{
+	ULONG from, to;
+
+	for (from = 0; from <= FSA4480_STATE_UNKNOWN; from++)
+	{
+		for (to = 0; to < FSA4480_STATE_COUNT; to++)
+		{
+			FSA4480_BuildTransitionProgram(
+				(FSA4480_STATE)from,
+				(FSA4480_STATE)to,
+				&Chip->Transitions[from][to]);
+		}
+	}
+}
+
+FSA4480_STATE
+FSA4480_GetCachedState(
+	PFSA4480_CHIP Chip)
+{
+	ULONG state;
+
+	for (state = 0; state < FSA4480_STATE_COUNT; state++)
+	{
+		if (FSA4480_IsRegisterCached(&Chip->RegisterCache, FSA4480_SWITCH_CONTROL, gStateTable[state].SwitchControl) &&
+			FSA4480_IsRegisterCached(&Chip->RegisterCache, FSA4480_SWITCH_SETTINGS, gStateTable[state].SwitchSettings))
+		{
+			return (FSA4480_STATE)state;
+		}
+	}
+
+	return FSA4480_STATE_UNKNOWN;
+}
+
+NTSTATUS
+FSA4480_CheckSwitchStatus(
+	BYTE SwitchStatus)
+{
+	NTSTATUS status;
+
+	if (SwitchStatus != 0x23 && SwitchStatus != 0x1C)
+	{
+		status = STATUS_INVALID_CONNECTION;
+
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Invalid AUX Switch Configuration for Display Port! SwitchStatus: %d",
+			SwitchStatus);
+	}
+	else
+	{
+		status = STATUS_SUCCESS;
+
+		TraceEvents(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_DRIVER,
+			"Valid AUX Switch Configuration for Display Port! SwitchStatus: %d",
+			SwitchStatus);
+	}
+
+	return status;
+}
+
+NTSTATUS
+FSA4480_ValidateDisplayPortSettings(
+	PFSA4480_CHIP Chip)
+{
+	NTSTATUS status;
+
+	BYTE SwitchStatus = 0;
+
+	status = FSA4480_ReadRegister(
+		Chip,
+		FSA4480_SWITCH_STATUS1,
+		&SwitchStatus);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error reading switch status - %!STATUS!",
+			status);
+
+		goto exit;
+	}
+
+	status = FSA4480_CheckSwitchStatus(SwitchStatus);
+
+exit:
+	return status;
+}
+
+NTSTATUS
+FSA4480_RunProgram(
+	PFSA4480_CHIP Chip,
+	PFSA4480_TRANSITION_PROGRAM Program)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	PFSA4480_STEP step;
+	ULONG i;
+
+	for (i = 0; i < Program->StepCount; i++)
+	{
+		step = &Program->Steps[i];
+
+		if (step->Type == FSA4480_STEP_SETTLE)
+		{
+			status = FSA4480_Delay(Chip, step->DelayUs);
+			if (!NT_SUCCESS(status))
+			{
+				goto exit;
+			}
+
+			FSA4480_MarkSwitchStage(Chip, FSA4480_LATENCY_STAGE_SETTLED);
+			continue;
+		}
+
+		status = FSA4480_WriteRegisters(
+			Chip,
+			step->Address,
+			step->Values,
+			step->Count);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		if (i == 0)
+		{
+			FSA4480_MarkSwitchStage(Chip, FSA4480_LATENCY_STAGE_PROGRAMMED);
+		}
+	}
+
+exit:
+	return status;
+}
+
+NTSTATUS
+FSA4480_ExecuteProgram(
+	PFSA4480_CHIP Chip,
+	PFSA4480_TRANSITION_PROGRAM Program,
+	BYTE *SwitchStatus)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	PFSA4480_REGISTER_CACHE registerCache;
+	FSA4480_STEP steps[FSA4480_MAX_BATCH_STEPS];
+	PFSA4480_STEP step;
+	ULONG stepCount = 0;
+	BOOLEAN settled = FALSE;
+	BOOLEAN traced;
+	LONGLONG startTime = 0;
+	LONGLONG elapsed = 0;
+	ULONG i;
+	registerCache = &Chip->RegisterCache;
+
+	for (i = 0; i < Program->StepCount; i++)
+	{
+		step = &Program->Steps[i];
+
+		if (step->Type == FSA4480_STEP_WRITE)
+		{
+			if (FSA4480_AreRegistersCached(registerCache, step->Address, step->Values, step->Count))
+			{
+				registerCache->WritesSkipped++;
+				continue;
+			}
+
+			//
+			// Later steps are filtered against the registers as this one
+			// leaves them, the cache is rolled back if the batch fails
+			//
+			registerCache->WritesIssued++;
+			FSA4480_UpdateRegisterCache(
+				registerCache,
+				step->Address,
+				step->Values,
+				step->Count,
+				STATUS_SUCCESS);
+		}
+		else
+		{
+			settled = TRUE;
+		}
+
+		steps[stepCount++] = *step;
+	}
+
+	//
+	// Nothing to wait for after the last write
+	//
+	if (stepCount != 0 && steps[stepCount - 1].Type == FSA4480_STEP_SETTLE)
+	{
+		stepCount--;
+		settled = FALSE;
+	}
+
+	if (SwitchStatus != NULL)
+	{
+		step = &steps[stepCount++];
+		step->Type = FSA4480_STEP_READ;
+		step->Address = FSA4480_SWITCH_STATUS1;
+		step->Count = 1;
+
+		registerCache->ReadsIssued++;
+	}
+
+	if (stepCount == 0)
+	{
+		goto exit;
+	}
+
+	traced = FSA4480_EVENTS_ENABLED(
+		FSA4480_EVENT_KEYWORD_REGISTER | FSA4480_EVENT_KEYWORD_STATUS);
+
+	//
+	// The controller waits out the settle delay inside the transaction,
+	// only the transaction as a whole can be timed
+	//
+	if (traced || settled)
+	{
+		startTime = Chip->Bus.QueryTime(Chip->Bus.Context);
+	}
+
+	//
+	// The whole program, settle delay and status read included, goes out
+	// as a single bus transaction
+	//
+	status = Chip->Bus.Execute(
+		Chip->Bus.Context,
+		steps,
+		stepCount);
+
+	if (traced || settled)
+	{
+		elapsed = Chip->Bus.QueryTime(Chip->Bus.Context) - startTime;
+	}
+
+	if (settled)
+	{
+		FSA4480_RecordSettleDelay(
+			Chip,
+			FSA4480_SWITCH_SETTLE_US,
+			status,
+			elapsed,
+			TRUE);
+	}
+
+	if (traced)
+	{
+		for (i = 0; i < stepCount; i++)
+		{
+			if (steps[i].Type == FSA4480_STEP_WRITE)
+			{
+				FSA4480_EVENT_REGISTER_WRITE(
+					steps[i].Address,
+					steps[i].Values,
+					steps[i].Count,
+					TRUE,
+					status,
+					elapsed);
+			}
+			else if (steps[i].Type == FSA4480_STEP_READ)
+			{
+				FSA4480_EVENT_STATUS_READ(
+					steps[i].Address,
+					NT_SUCCESS(status) ? steps[i].Values[0] : 0,
+					TRUE,
+					status,
+					elapsed);
+			}
+		}
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		for (i = 0; i < stepCount; i++)
+		{
+			if (steps[i].Type == FSA4480_STEP_WRITE)
+			{
+				FSA4480_UpdateRegisterCache(
+					registerCache,
+					steps[i].Address,
+					steps[i].Values,
+					steps[i].Count,
+					status);
+			}
+		}
+
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error executing %d step transition program - %!STATUS!",
+			stepCount,
+			status);
+
+		goto exit;
+	}
+
+	//
+	// Stages inside the transaction are not observable, they complete
+	// with it
+	//
+	FSA4480_MarkSwitchStage(Chip, FSA4480_LATENCY_STAGE_PROGRAMMED);
+
+	if (settled)
+	{
+		FSA4480_MarkSwitchStage(Chip, FSA4480_LATENCY_STAGE_SETTLED);
+	}
+
+	if (SwitchStatus != NULL)
+	{
+		*SwitchStatus = steps[stepCount - 1].Values[0];
+	}
+
+exit:
+	return status;
+}
 
 NTSTATUS
-FSA4480_UpdateSettings(
-	WDFDEVICE Device,
-	BYTE SwitchControl,
-	BYTE SwitchEnable)
+FSA4480_ApplyProfile(
+	PFSA4480_CHIP Chip,
+	FSA4480_PROFILE Profile)
 {
-	NTSTATUS status;
-	PDEVICE_CONTEXT deviceContext;
-	LARGE_INTEGER delay = {0};
+	NTSTATUS status = STATUS_SUCCESS;
+	BYTE *values = Chip->ProfileTable.Profiles[Profile];
+	ULONG first = 0;
+	ULONG last = FSA4480_PROFILE_REGISTER_COUNT;
+
+	if (Profile == Chip->ActiveProfile)
+	{
+		goto exit;
+	}
 
-	deviceContext = (PDEVICE_CONTEXT)DeviceGetContext(Device);
+	//
+	// Profiles tend to differ in a few registers only, just the span
+	// between the first and last one not already holding the new value
+	// goes out
+	//
+	while (first < last &&
+		   FSA4480_IsRegisterCached(
+			   &Chip->RegisterCache,
+			   (BYTE)(FSA4480_PROFILE_FIRST_REGISTER + first),
+			   values[first]))
+	{
+		first++;
+	}
 
-	BYTE Data = 0x80;
+	while (last > first &&
+		   FSA4480_IsRegisterCached(
+			   &Chip->RegisterCache,
+			   (BYTE)(FSA4480_PROFILE_FIRST_REGISTER + last - 1),
+			   values[last - 1]))
+	{
+		last--;
+	}
 
-	if (!deviceContext->InitializedSpbHardware)
+	if (first < last)
 	{
-		status = STATUS_INSUFFICIENT_RESOURCES;
+		status = FSA4480_WriteRegisters(
+			Chip,
+			(BYTE)(FSA4480_PROFILE_FIRST_REGISTER + first),
+			&values[first],
+			last - first);
+	}
 
+	if (!NT_SUCCESS(status))
+	{
 		TraceEvents(
 			TRACE_LEVEL_ERROR,
 			TRACE_DRIVER,
-			"Spb Hardware is not yet initialized, aborting - %!STATUS!",
+			"Error programming profile %d - %!STATUS!",
+			Profile,
 			status);
 
+		Chip->ActiveProfile = FSA4480_PROFILE_COUNT;
 		goto exit;
 	}
 
-	status = SpbWriteDataSynchronously(
-		&deviceContext->I2CContext,
-		FSA4480_SWITCH_SETTINGS,
-		&Data,
-		1);
+	TraceEvents(
+		TRACE_LEVEL_VERBOSE,
+		TRACE_DRIVER,
+		"Profile %d -> %d, %d register(s) written",
+		Chip->ActiveProfile,
+		Profile,
+		last - first);
+
+	Chip->ActiveProfile = Profile;
+
+exit:
+	return status;
+}
+
+NTSTATUS
+FSA4480_ProgramTransition(
+	PFSA4480_CHIP Chip,
+	FSA4480_STATE Target,
+	BYTE *SwitchStatus)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	PFSA4480_TRANSITION_PROGRAM program;
+	PFSA4480_TRANSITION_PROGRAM fullProgram;
+	ULONG i;
+
+	//
+	// The switches the program closes use the target's profile
+	//
+	status = FSA4480_ApplyProfile(
+		Chip,
+		(FSA4480_PROFILE)Chip->ProfileTable.Selection[gStateTable[Target].ProfileUsage]);
 
 	if (!NT_SUCCESS(status))
 	{
-		TraceEvents(
-			TRACE_LEVEL_ERROR,
-			TRACE_DRIVER,
-			"Error in Spb initialization - %!STATUS!",
-			status);
-
+		Chip->State = FSA4480_STATE_UNKNOWN;
 		goto exit;
 	}
 
-	if (!deviceContext->InitializedSpbHardware)
+	program = &Chip->Transitions[Chip->State][Target];
+
+	if (program->StepCount == 0)
 	{
-		status = STATUS_INSUFFICIENT_RESOURCES;
+		//
+		// The chip already holds the requested configuration, skip the
+		// whole disable - program - enable sequence and its settle delay.
+		// Those are the writes of the full program into the state.
+		//
+		fullProgram = &Chip->Transitions[FSA4480_STATE_UNKNOWN][Target];
+
+		for (i = 0; i < fullProgram->StepCount; i++)
+		{
+			if (fullProgram->Steps[i].Type == FSA4480_STEP_WRITE)
+			{
+				Chip->RegisterCache.WritesSkipped++;
+			}
+		}
 
 		TraceEvents(
-			TRACE_LEVEL_ERROR,
+			TRACE_LEVEL_INFORMATION,
 			TRACE_DRIVER,
-			"Spb Hardware is not yet initialized, aborting - %!STATUS!",
-			status);
+			"Switch state %d already applied, %d bus writes saved so far",
+			Target,
+			Chip->RegisterCache.WritesSkipped);
+	}
+	else
+	{
+		TraceEvents(
+			TRACE_LEVEL_VERBOSE,
+			TRACE_DRIVER,
+			"Switch state %d -> %d, %d step(s)",
+			Chip->State,
+			Target,
+			program->StepCount);
+	}
+
+	if (Chip->Bus.Execute != NULL)
+	{
+		status = FSA4480_ExecuteProgram(Chip, program, SwitchStatus);
+	}
+	else
+	{
+		status = FSA4480_RunProgram(Chip, program);
+	}
 
+	if (!NT_SUCCESS(status))
+	{
+		//
+		// The program stopped halfway, the next one starts from scratch
+		//
+		Chip->State = FSA4480_STATE_UNKNOWN;
 		goto exit;
 	}
 
-	status = SpbWriteDataSynchronously(
-		&deviceContext->I2CContext,
-		FSA4480_SWITCH_CONTROL,
-		&SwitchControl,
-		1);
+	Chip->State = Target;
 
-	if (!NT_SUCCESS(status))
+exit:
+	return status;
+}
+
+NTSTATUS
+FSA4480_Recover(
+	PFSA4480_CHIP Chip,
+	FSA4480_STATE Target,
+	NTSTATUS FailedStatus,
+	BYTE *SwitchStatus)
+{
+	NTSTATUS status = FailedStatus;
+	PFSA4480_RECOVERY recovery;
+	PFSA4480_TRANSITION_PROGRAM program;
+	FSA4480_PROFILE profile;
+	FSA4480_STEP steps[FSA4480_MAX_BATCH_STEPS];
+	PFSA4480_STEP step;
+	ULONG stepCount = 0;
+	BOOLEAN settled = FALSE;
+	LONGLONG now;
+	ULONG i;
+	recovery = &Chip->Recovery;
+	program = &Chip->Transitions[FSA4480_STATE_UNKNOWN][Target];
+	profile = (FSA4480_PROFILE)Chip->ProfileTable.Selection[gStateTable[Target].ProfileUsage];
+
+	now = Chip->Bus.QueryTime(Chip->Bus.Context);
+
+	//
+	// A bus that keeps failing is not fixed by resetting the chip over
+	// and over, such failures go back to the caller as they are
+	//
+	if (recovery->LastTime != 0 &&
+		now - recovery->LastTime < Chip->Bus.TimeFrequency * FSA4480_RECOVERY_INTERVAL_MS / 1000)
 	{
+		recovery->Suppressed++;
+
 		TraceEvents(
-			TRACE_LEVEL_ERROR,
+			TRACE_LEVEL_WARNING,
 			TRACE_DRIVER,
-			"Error in Spb initialization - %!STATUS!",
-			status);
+			"Switch state %d failed within %d ms of the last recovery, %d left alone so far",
+			Target,
+			FSA4480_RECOVERY_INTERVAL_MS,
+			recovery->Suppressed);
 
 		goto exit;
 	}
 
-	delay.QuadPart = RELATIVE(MICROSECONDS(55));
-	status = KeDelayExecutionThread(KernelMode, TRUE, &delay);
-	if (!NT_SUCCESS(status))
+	recovery->LastTime = now;
+	recovery->Attempts++;
+
+	//
+	// The reset returns every register to its power-on value, nothing the
+	// cache holds survives it
+	//
+	FSA4480_InvalidateRegisterCache(Chip);
+	Chip->State = FSA4480_STATE_UNKNOWN;
+	Chip->ActiveProfile = FSA4480_PROFILE_COUNT;
+
+	RtlZeroMemory(steps, sizeof(steps));
+
+	step = &steps[stepCount++];
+	step->Type = FSA4480_STEP_WRITE;
+	step->Address = FSA4480_RESET;
+	step->Count = 1;
+	step->Values[0] = FSA4480_RESET_DEVICE;
+
+	step = &steps[stepCount++];
+	step->Type = FSA4480_STEP_SETTLE;
+	step->DelayUs = FSA4480_RESET_SETTLE_US;
+
+	step = &steps[stepCount++];
+	step->Type = FSA4480_STEP_WRITE;
+	step->Address = FSA4480_PROFILE_FIRST_REGISTER;
+	step->Count = FSA4480_PROFILE_REGISTER_COUNT;
+
+	RtlCopyMemory(
+		step->Values,
+		Chip->ProfileTable.Profiles[profile],
+		FSA4480_PROFILE_REGISTER_COUNT);
+
+	for (i = 0; i < program->StepCount; i++)
 	{
-		TraceEvents(
-			TRACE_LEVEL_ERROR,
-			TRACE_DRIVER,
-			"KeDelayExecutionThread failed with Status = 0x%08lX\n",
-			status);
+		if (program->Steps[i].Type == FSA4480_STEP_SETTLE)
+		{
+			settled = TRUE;
+		}
 
-		goto exit;
+		steps[stepCount++] = program->Steps[i];
 	}
 
-	if (!deviceContext->InitializedSpbHardware)
+	if (Chip->Bus.Execute != NULL)
 	{
-		status = STATUS_INSUFFICIENT_RESOURCES;
+		if (SwitchStatus != NULL)
+		{
+			step = &steps[stepCount++];
+			step->Type = FSA4480_STEP_READ;
+			step->Address = FSA4480_SWITCH_STATUS1;
+			step->Count = 1;
 
-		TraceEvents(
-			TRACE_LEVEL_ERROR,
-			TRACE_DRIVER,
-			"Spb Hardware is not yet initialized, aborting - %!STATUS!",
-			status);
+			Chip->RegisterCache.ReadsIssued++;
+		}
 
-		goto exit;
+		//
+		// Reset, profile, switches and status read in a single bus
+		// transaction. The reset settle is not a switch settle, the
+		// transaction stays out of SettleDelay.
+		//
+		status = Chip->Bus.Execute(
+			Chip->Bus.Context,
+			steps,
+			stepCount);
+
+		for (i = 0; NT_SUCCESS(status) && i < stepCount; i++)
+		{
+			if (steps[i].Type == FSA4480_STEP_WRITE)
+			{
+				Chip->RegisterCache.WritesIssued++;
+				FSA4480_UpdateRegisterCache(
+					&Chip->RegisterCache,
+					steps[i].Address,
+					steps[i].Values,
+					steps[i].Count,
+					status);
+			}
+		}
+
+		if (NT_SUCCESS(status) && SwitchStatus != NULL)
+		{
+			*SwitchStatus = steps[stepCount - 1].Values[0];
+		}
 	}
+	else
+	{
+		status = STATUS_SUCCESS;
 
-	status = SpbWriteDataSynchronously(
-		&deviceContext->I2CContext,
-		FSA4480_SWITCH_SETTINGS,
-		&SwitchEnable,
-		1);
+		//
+		// Settles wait on the bus directly, like the batch above they
+		// stay out of SettleDelay
+		//
+		for (i = 0; NT_SUCCESS(status) && i < stepCount; i++)
+		{
+			status = steps[i].Type == FSA4480_STEP_SETTLE
+						 ? Chip->Bus.Delay(Chip->Bus.Context, steps[i].DelayUs)
+						 : FSA4480_WriteRegisters(Chip, steps[i].Address, steps[i].Values, steps[i].Count);
+		}
+	}
 
 	if (!NT_SUCCESS(status))
 	{
+		FSA4480_InvalidateRegisterCache(Chip);
+
 		TraceEvents(
 			TRACE_LEVEL_ERROR,
 			TRACE_DRIVER,
-			"Error in Spb initialization - %!STATUS!",
+			"Error recovering switch state %d - %!STATUS!",
+			Target,
 			status);
 
 		goto exit;
 	}
 
+	Chip->State = Target;
+	Chip->ActiveProfile = profile;
+	recovery->Succeeded++;
+
+	FSA4480_MarkSwitchStage(Chip, FSA4480_LATENCY_STAGE_PROGRAMMED);
+
+	if (settled)
+	{
+		FSA4480_MarkSwitchStage(Chip, FSA4480_LATENCY_STAGE_SETTLED);
+	}
+
+	TraceEvents(
+		TRACE_LEVEL_WARNING,
+		TRACE_DRIVER,
+		"Switch state %d recovered by a soft reset after 0x%08lX, %d of %d recoveries succeeded",
+		Target,
+		FailedStatus,
+		recovery->Succeeded,
+		recovery->Attempts);
+
 exit:
 	return status;
 }
 
 NTSTATUS
-FSA4480_SetDefaultRegisterSettings(
-	WDFDEVICE Device)
+FSA4480_RunTransition(
+	PFSA4480_CHIP Chip,
+	FSA4480_STATE Target)
 {
 	NTSTATUS status = STATUS_SUCCESS;
-	PDEVICE_CONTEXT deviceContext;
-	UINT32 i = 0;
+	BOOLEAN validate = gStateTable[Target].ValidateDisplayPort;
+	BYTE switchStatus = 0;
+	BYTE *batchedStatus;
+	FSA4480_STATE source;
+	BOOLEAN traced;
+	LONGLONG startTime = 0;
+
+	if (Chip->State == FSA4480_STATE_UNKNOWN)
+	{
+		Chip->State = FSA4480_GetCachedState(Chip);
+	}
 
-	deviceContext = (PDEVICE_CONTEXT)DeviceGetContext(Device);
+	source = Chip->State;
+	traced = FSA4480_EVENTS_ENABLED(FSA4480_EVENT_KEYWORD_TRANSITION);
 
-	for (i = 0; i < ARRAYSIZE(gDefaultRegisterSettings); i++)
+	if (traced)
 	{
-		if (!deviceContext->InitializedSpbHardware)
-		{
-			status = STATUS_INSUFFICIENT_RESOURCES;
+		startTime = Chip->Bus.QueryTime(Chip->Bus.Context);
 
-			TraceEvents(
-				TRACE_LEVEL_ERROR,
-				TRACE_DRIVER,
-				"Spb Hardware is not yet initialized, aborting - %!STATUS!",
-				status);
+		FSA4480_EVENT_TRANSITION_BEGIN(
+			source,
+			Target,
+			Chip->Transitions[source][Target].StepCount,
+			Chip->Bus.Execute != NULL);
+	}
 
-			goto exit;
-		}
+	//
+	// A batched program reads the switch status itself
+	//
+	batchedStatus = Chip->Bus.Execute != NULL && validate ? &switchStatus : NULL;
+
+	status = FSA4480_ProgramTransition(Chip, Target, batchedStatus);
 
-		status = SpbWriteDataSynchronously(
-			&deviceContext->I2CContext,
-			gDefaultRegisterSettings[i].Address,
-			&gDefaultRegisterSettings[i].Value,
-			1);
+	if (!NT_SUCCESS(status))
+	{
+		//
+		// Rather than leave the chip half-programmed until the next CC
+		// change, start it over from its reset values
+		//
+		status = FSA4480_Recover(Chip, Target, status, batchedStatus);
 
 		if (!NT_SUCCESS(status))
 		{
-			TraceEvents(
-				TRACE_LEVEL_ERROR,
-				TRACE_DRIVER,
-				"Error writing default register: %d - %!STATUS!",
-				gDefaultRegisterSettings[i].Address,
-				status);
-
 			goto exit;
 		}
 	}
 
+	if (validate)
+	{
+		status = batchedStatus != NULL
+					 ? FSA4480_CheckSwitchStatus(switchStatus)
+					 : FSA4480_ValidateDisplayPortSettings(Chip);
+	}
+
 exit:
+	FSA4480_PublishState(Chip);
+
+	if (traced)
+	{
+		FSA4480_EVENT_TRANSITION_END(
+			source,
+			Target,
+			status,
+			Chip->Bus.QueryTime(Chip->Bus.Context) - startTime);
+	}
+
 	return status;
 }
 
 NTSTATUS
 FSA4480_SetupChipGPIOs(
-	WDFDEVICE Device,
+	PFSA4480_CHIP Chip,
 	USBC_PARTNER USBCPartner)
 {
 	NTSTATUS status = STATUS_SUCCESS;
-	PDEVICE_CONTEXT deviceContext;
-
-	deviceContext = (PDEVICE_CONTEXT)DeviceGetContext(Device);
+	FSA4480_LATENCY_MODE latencyMode = FSA4480_LATENCY_MODE_COUNT;
 
 	if (USBCPartner == UsbCPartnerAudioAccessory)
 	{
-		status = FSA4480_UpdateSettings(Device, 0x00, 0x9F);
+		status = FSA4480_RunTransition(Chip, FSA4480_STATE_AUDIO_ACCESSORY);
+		latencyMode = FSA4480_LATENCY_MODE_AUDIO_ACCESSORY;
 	}
 	else if (USBCPartner == UsbCPartnerInvalid)
 	{
-		status = FSA4480_UpdateSettings(Device, 0x18, 0x98);
+		status = FSA4480_RunTransition(Chip, FSA4480_STATE_USB_SAFE);
 	}
 
+	FSA4480_EndSwitchTiming(
+		Chip,
+		NT_SUCCESS(status) ? latencyMode : FSA4480_LATENCY_MODE_COUNT);
+
 	return status;
 }
 
 NTSTATUS
 FSA4480_OnUSBCModeChanged(
-	WDFDEVICE Device,
+	PFSA4480_CHIP Chip,
 	USBC_PARTNER USBCPartner)
 {
 	NTSTATUS status = STATUS_SUCCESS;
-	PDEVICE_CONTEXT deviceContext;
-
-	deviceContext = (PDEVICE_CONTEXT)DeviceGetContext(Device);
 
 	if ((USBCPartner == UsbCPartnerInvalid ||
 		 USBCPartner == UsbCPartnerAudioAccessory) &&
-		USBCPartner != deviceContext->USBCPartner)
-	{
-		deviceContext->USBCPartner = USBCPartner;
-		status = FSA4480_SetupChipGPIOs(Device, USBCPartner);
-	}
-
-	return status;
-}
-
-NTSTATUS
-FSA4480_ValidateDisplayPortSettings(
-	WDFDEVICE Device)
-{
-	NTSTATUS status;
-	PDEVICE_CONTEXT deviceContext;
-	deviceContext = (PDEVICE_CONTEXT)DeviceGetContext(Device);
-
-	UINT32 SwitchStatus = 0;
-
-	if (!deviceContext->InitializedSpbHardware)
-	{
-		status = STATUS_INSUFFICIENT_RESOURCES;
-
-		TraceEvents(
-			TRACE_LEVEL_ERROR,
-			TRACE_DRIVER,
-			"Spb Hardware is not yet initialized, aborting - %!STATUS!",
-			status);
-
-		goto exit;
-	}
-
-	status = SpbReadDataSynchronously(
-		&deviceContext->I2CContext,
-		FSA4480_SWITCH_STATUS1,
-		&SwitchStatus,
-		1);
-
-	if (!NT_SUCCESS(status))
-	{
-		TraceEvents(
-			TRACE_LEVEL_ERROR,
-			TRACE_DRIVER,
-			"Error in Spb initialization - %!STATUS!",
-			status);
-
-		goto exit;
-	}
-	else
+		USBCPartner != Chip->USBCPartner)
 	{
-		if (SwitchStatus != 0x23 && SwitchStatus != 0x1C)
-		{
-			status = STATUS_INVALID_CONNECTION;
-
-			TraceEvents(
-				TRACE_LEVEL_ERROR,
-				TRACE_DRIVER,
-				"Invalid AUX Switch Configuration for Display Port! SwitchStatus: %d",
-				SwitchStatus);
-
-			goto exit;
-		}
-		else
-		{
-			status = STATUS_SUCCESS;
+		Chip->USBCPartner = USBCPartner;
 
-			TraceEvents(
-				TRACE_LEVEL_INFORMATION,
-				TRACE_DRIVER,
-				"Valid AUX Switch Configuration for Display Port! SwitchStatus: %d",
-				SwitchStatus);
-
-			goto exit;
-		}
+		FSA4480_BeginSwitchTiming(Chip, FSA4480_LATENCY_SOURCE_COUNT, 0);
+		status = FSA4480_SetupChipGPIOs(Chip, USBCPartner);
 	}
 
-exit:
 	return status;
 }
 
 NTSTATUS
 FSA4480_Switch(
-	WDFDEVICE Device,
+	PFSA4480_CHIP Chip,
 	FSA4480_SWITCH_MODE SwitchMode)
 {
 	NTSTATUS status = STATUS_SUCCESS;
-	PDEVICE_CONTEXT deviceContext;
 	BYTE SwitchControl = 0x00;
-	deviceContext = (PDEVICE_CONTEXT)DeviceGetContext(Device);
+	FSA4480_STATE targetState;
+	FSA4480_LATENCY_MODE latencyMode = FSA4480_LATENCY_MODE_COUNT;
 
 	switch (SwitchMode)
 	{
 	// TODO: Hook into Audio Jack EU GPIO to swap the button behavior on MBHC headsets
 	case FSA4480_SWAP_MIC_GND:
 	{
-		if (!deviceContext->InitializedSpbHardware)
+		latencyMode = FSA4480_LATENCY_MODE_MIC_GND_SWAP;
+
+		//
+		// Toggling between the two audio states only reroutes the MIC,
+		// SENSE and AGND switches, the transition program leaves D+/D-
+		// alone. SWITCH_CONTROL is only consulted when the state is not
+		// known, a headset probing both polarities never waits for a read.
+		//
+		if (Chip->State == FSA4480_STATE_AUDIO_ACCESSORY)
 		{
-			status = STATUS_INSUFFICIENT_RESOURCES;
-
-			TraceEvents(
-				TRACE_LEVEL_ERROR,
-				TRACE_DRIVER,
-				"Spb Hardware is not yet initialized, aborting - %!STATUS!",
-				status);
+			targetState = FSA4480_STATE_AUDIO_MIC_GND_SWAPPED;
+			break;
+		}
 
-			goto exit;
+		if (Chip->State == FSA4480_STATE_AUDIO_MIC_GND_SWAPPED)
+		{
+			targetState = FSA4480_STATE_AUDIO_ACCESSORY;
+			break;
 		}
 
-		status = SpbReadDataSynchronously(
-			&deviceContext->I2CContext,
+		status = FSA4480_ReadRegister(
+			Chip,
 			FSA4480_SWITCH_CONTROL,
-			&SwitchControl,
-			1);
+			&SwitchControl);
 
 		if (!NT_SUCCESS(status))
 		{
 			TraceEvents(
 				TRACE_LEVEL_ERROR,
 				TRACE_DRIVER,
-				"Error in Spb initialization - %!STATUS!",
+				"Error reading switch control - %!STATUS!",
 				status);
 
 			goto exit;
@@ -332,89 +1581,127 @@ FSA4480_Switch(
 
 		if ((SwitchControl & 0x07) == 0x07)
 		{
-			SwitchControl = 0x00;
+			targetState = FSA4480_STATE_AUDIO_ACCESSORY;
 		}
 		else
 		{
-			SwitchControl = 0x07;
+			targetState = FSA4480_STATE_AUDIO_MIC_GND_SWAPPED;
 		}
 
-		status = FSA4480_UpdateSettings(Device, SwitchControl, 0x9F);
 		break;
 	}
 	case FSA4480_SET_USBC_CC1:
 	{
-		status = FSA4480_UpdateSettings(Device, 0x18, 0xF8);
-
-		if (!NT_SUCCESS(status))
-		{
-			TraceEvents(
-				TRACE_LEVEL_ERROR,
-				TRACE_DRIVER,
-				"Error in FSA4480_UpdateSettings - %!STATUS!",
-				status);
-
-			goto exit;
-		}
-
-		status = FSA4480_ValidateDisplayPortSettings(Device);
+		targetState = FSA4480_STATE_DP_CC1;
+		latencyMode = FSA4480_LATENCY_MODE_CC1;
+		Chip->Orientation = FSA4480_ORIENTATION_CC1;
 		break;
 	}
 	case FSA4480_SET_USBC_CC2:
 	{
-		status = FSA4480_UpdateSettings(Device, 0x78, 0xF8);
-
-		if (!NT_SUCCESS(status))
-		{
-			TraceEvents(
-				TRACE_LEVEL_ERROR,
-				TRACE_DRIVER,
-				"Error in FSA4480_UpdateSettings - %!STATUS!",
-				status);
-
-			goto exit;
-		}
-
-		status = FSA4480_ValidateDisplayPortSettings(Device);
+		targetState = FSA4480_STATE_DP_CC2;
+		latencyMode = FSA4480_LATENCY_MODE_CC2;
+		Chip->Orientation = FSA4480_ORIENTATION_CC2;
 		break;
 	}
 	case FSA4480_SET_DP_DISCONNECTED:
 	{
-		status = FSA4480_UpdateSettings(Device, 0x18, 0x98);
+		targetState = FSA4480_STATE_USB_SAFE;
+		latencyMode = FSA4480_LATENCY_MODE_DP_DISCONNECTED;
+		Chip->Orientation = FSA4480_ORIENTATION_OPEN;
 		break;
 	}
+	default:
+	{
+		status = STATUS_INVALID_PARAMETER;
+		goto exit;
+	}
+	}
+
+	status = FSA4480_RunTransition(Chip, targetState);
+	if (!NT_SUCCESS(status))
+	{
+		TraceEvents(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Error in FSA4480_RunTransition - %!STATUS!",
+			status);
+
+		goto exit;
 	}
 
 exit:
+	FSA4480_EndSwitchTiming(
+		Chip,
+		NT_SUCCESS(status) ? latencyMode : FSA4480_LATENCY_MODE_COUNT);
+
+	return status;
+}
+
+VOID
+FSA4480_PowerDown(
+	PFSA4480_CHIP Chip)
+{
+	//
+	// EN is released after this, the chip loses its state
+	//
+	FSA4480_InvalidateRegisterCache(Chip);
+	Chip->State = FSA4480_STATE_UNKNOWN;
+	Chip->ActiveProfile = FSA4480_PROFILE_COUNT;
+
+	FSA4480_PublishState(Chip);
+}
+
+NTSTATUS
+FSA4480_PowerUp(
+	PFSA4480_CHIP Chip)
+{
+	NTSTATUS status;
+
+	//
+	// The chip was just powered through EN, nothing we knew about it holds.
+	// Only the USB profile is restored here, the next transition starts
+	// from FSA4480_STATE_UNKNOWN and programs the switches in full.
+	//
+	FSA4480_PowerDown(Chip);
+
+	status = FSA4480_ApplyProfile(
+		Chip,
+		(FSA4480_PROFILE)Chip->ProfileTable.Selection[FSA4480_PROFILE_USAGE_USB]);
+
+	FSA4480_PublishState(Chip);
+
 	return status;
 }
 
 NTSTATUS
 FSA4480_Initialize(
-	WDFDEVICE Device)
+	PFSA4480_CHIP Chip,
+	FSA4480_SWITCH_MODE SwitchMode)
 {
 	NTSTATUS status = STATUS_SUCCESS;
 
-	status = FSA4480_SetDefaultRegisterSettings(Device);
+	FSA4480_BuildTransitionPrograms(Chip);
+	Chip->Orientation = FSA4480_ORIENTATION_OPEN;
+
+	status = FSA4480_PowerUp(Chip);
 	if (!NT_SUCCESS(status))
 	{
-		TraceEvents(
-			TRACE_LEVEL_ERROR,
-			TRACE_DRIVER,
-			"Error writing default registers - %!STATUS!",
-			status);
-
 		goto exit;
 	}
 
-	// TODO: Get real current status
-	status = FSA4480_SetupChipGPIOs(Device, UsbCPartnerInvalid);
+	//
+	// Straight from the unknown state into the current configuration,
+	// without a detour through the disconnected one
+	//
+	status = FSA4480_Switch(Chip, SwitchMode);
 	if (!NT_SUCCESS(status))
 	{
 		TraceEvents(
 			TRACE_LEVEL_ERROR,
 			TRACE_DRIVER,
-			"Error setting up chip gpios - %!STATUS!",
+			"Error switching to initial mode %d - %!STATUS!",
+			SwitchMode,
 			status);
 
 		goto exit;
@@ -426,12 +1713,12 @@ exit:
 
 NTSTATUS
 FSA4480_Uninitialize(
-	WDFDEVICE Device)
+	PFSA4480_CHIP Chip)
 {
 	NTSTATUS status;
 
 	// TODO: Do not reset switch settings for usb digital hs
-	status = FSA4480_SetupChipGPIOs(Device, UsbCPartnerInvalid);
+	status = FSA4480_SetupChipGPIOs(Chip, UsbCPartnerInvalid);
 	if (!NT_SUCCESS(status))
 	{
 		TraceEvents(
@@ -444,5 +1731,25 @@ FSA4480_Uninitialize(
 	}
 
 exit:
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Register cache: %d writes issued, %d skipped, %d reads issued, %d served",
+		Chip->RegisterCache.WritesIssued,
+		Chip->RegisterCache.WritesSkipped,
+		Chip->RegisterCache.ReadsIssued,
+		Chip->RegisterCache.ReadsServed);
+
+	FSA4480_PowerDown(Chip);
+
+	TraceEvents(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Settle delay: last requested %d us, last actual %d us, max actual %d us, max batch %d us",
+		Chip->SettleDelay.LastRequestedUs,
+		Chip->SettleDelay.LastActualUs,
+		Chip->SettleDelay.MaxActualUs,
+		Chip->SettleDelay.MaxBatchedUs);
+
 	return status;
 }
\ No newline at end of file
@@ -1,7 +1,17 @@
 #pragma once
 
+//
+// The chip logic in fsa4480.c only talks to the hardware through
+// FSA4480_BUS, so it can also be built on the host (FSA4480_HOST) against
+// a simulated register file, see bench\.
+//
+#ifdef FSA4480_HOST
+#include "host.h"
+#else
 #include <ntddk.h>
-#include <wdf.h>
+#endif
+
+#include "Public.h"
 
 typedef enum _USBC_PARTNER {
   UsbCPartnerInvalid,
@@ -50,8 +60,10 @@ typedef enum _USBC_PARTNER {
 	(((signed __int64)(seconds)) * MILLISECONDS(1000L))
 #endif
 
+#define FSA4480_DEVICE_ID 0x00
 #define FSA4480_SWITCH_SETTINGS 0x04
 #define FSA4480_SWITCH_CONTROL 0x05
+#define FSA4480_SWITCH_STATUS0 0x06
 #define FSA4480_SWITCH_STATUS1 0x07
 #define FSA4480_SLOW_L 0x08
 #define FSA4480_SLOW_R 0x09
@@ -62,27 +74,310 @@ typedef enum _USBC_PARTNER {
 #define FSA4480_DELAY_L_MIC 0x0E
 #define FSA4480_DELAY_L_SENSE 0x0F
 #define FSA4480_DELAY_L_AGND 0x10
+#define FSA4480_FUNCTION_ENABLE 0x12
+#define FSA4480_JACK_STATUS 0x17
+#define FSA4480_DETECTION_INT 0x18
 #define FSA4480_RESET 0x1E
 
-typedef struct _FSA4480_DEFAULT_REGISTER_SETTING
+//
+// Self-clearing, returns every register to its power-on value
+//
+#define FSA4480_RESET_DEVICE 0x01
+
+#define FSA4480_REGISTER_COUNT 0x20
+
+//
+// Registers whose contents are changed by the chip itself (status, detection
+// results and the self-clearing reset bit) and therefore must always be read
+// from the bus and never filtered on write.
+//
+#define FSA4480_VOLATILE_REGISTER_MASK     \
+	((1UL << FSA4480_SWITCH_STATUS0) |     \
+	 (1UL << FSA4480_SWITCH_STATUS1) |     \
+	 (1UL << FSA4480_JACK_STATUS) |        \
+	 (1UL << FSA4480_DETECTION_INT) |      \
+	 (1UL << FSA4480_RESET))
+
+#define FSA4480_IS_VOLATILE_REGISTER(Address) \
+	((FSA4480_VOLATILE_REGISTER_MASK & (1UL << (Address))) != 0)
+
+//
+// Write-through shadow of the FSA4480 register file. A register is only
+// served from the shadow once its bit is set in ValidMask, which happens
+// after a successful bus write or read of a non-volatile register.
+//
+typedef struct _FSA4480_REGISTER_CACHE
 {
+	BYTE Values[FSA4480_REGISTER_COUNT];
+	ULONG ValidMask;
+
+	ULONG WritesIssued;
+	ULONG WritesSkipped;
+	ULONG ReadsIssued;
+	ULONG ReadsServed;
+} FSA4480_REGISTER_CACHE, *PFSA4480_REGISTER_CACHE;
+
+//
+// Time the analog switches need after SWITCH_CONTROL is programmed and
+// before they are enabled again
+//
+#define FSA4480_SWITCH_SETTLE_US 55
+
+//
+// Time the chip needs to come back from a RESET_DEVICE write, a transfer
+// sent earlier is not acknowledged. The datasheet gives no figure for
+// the soft reset, this is a conservative margin and not a characterized
+// value.
+//
+#define FSA4480_RESET_SETTLE_US 1000
+
+//
+// Requested and measured duration of the settle delays. A delay the
+// controller waits out inside a batch cannot be timed on its own, its
+// sample is the duration of the whole transaction: LastBatched is set and
+// it counts towards MaxBatchedUs instead of MaxActualUs. Recovery
+// programs wait out a soft reset and are not recorded.
+//
+typedef struct _FSA4480_SETTLE_DELAY
+{
+	ULONG LastRequestedUs;
+	ULONG LastActualUs;
+	ULONG MaxActualUs;
+	BOOLEAN LastBatched;
+	ULONG MaxBatchedUs;
+} FSA4480_SETTLE_DELAY, *PFSA4480_SETTLE_DELAY;
+
+//
+// Timestamps (FSA4480_BUS time ticks) of the switch in progress, see
+// FSA4480_LATENCY_STAGE. StartTime is 0 when no switch is being timed,
+// Source is FSA4480_LATENCY_SOURCE_COUNT when it was not triggered by a
+// CC change.
+//
+typedef struct _FSA4480_SWITCH_TIMING
+{
+	FSA4480_LATENCY_SOURCE Source;
+	LONGLONG StartTime;
+	LONGLONG StageTimes[FSA4480_LATENCY_STAGE_COUNT];
+} FSA4480_SWITCH_TIMING, *PFSA4480_SWITCH_TIMING;
+
+//
+// The SLOW_L to DELAY_L_AGND registers set how the analog switches close.
+// Every state uses the FSA4480_PROFILE its caller selected for the kind of
+// partner it serves, the registers are reprogrammed on the way into a
+// state using another one.
+//
+#define FSA4480_PROFILE_FIRST_REGISTER FSA4480_SLOW_L
+#define FSA4480_PROFILE_REGISTER_COUNT (FSA4480_DELAY_L_AGND - FSA4480_SLOW_L + 1)
+
+typedef enum _FSA4480_PROFILE_USAGE
+{
+	FSA4480_PROFILE_USAGE_USB,
+	FSA4480_PROFILE_USAGE_DISPLAYPORT,
+	FSA4480_PROFILE_USAGE_AUDIO_ACCESSORY,
+	FSA4480_PROFILE_USAGE_COUNT
+} FSA4480_PROFILE_USAGE;
+
+typedef struct _FSA4480_PROFILE_TABLE
+{
+	BYTE Profiles[FSA4480_PROFILE_COUNT][FSA4480_PROFILE_REGISTER_COUNT];
+	BYTE Selection[FSA4480_PROFILE_USAGE_COUNT];
+} FSA4480_PROFILE_TABLE, *PFSA4480_PROFILE_TABLE;
+
+typedef struct _FSA4480_STATE_DESCRIPTOR
+{
+	BYTE SwitchControl;
+	BYTE SwitchSettings;
+	BOOLEAN ValidateDisplayPort;
+	BYTE ProfileUsage;
+} FSA4480_STATE_DESCRIPTOR, *PFSA4480_STATE_DESCRIPTOR;
+
+//
+// SWITCH_SETTINGS bit 7 enables the device, bits 0-6 enable one analog
+// switch each. Bit i of SWITCH_CONTROL selects the routing of the switch
+// enabled by bit i of SWITCH_SETTINGS.
+//
+#define FSA4480_SETTINGS_DEVICE_ENABLE 0x80
+#define FSA4480_SWITCH_MASK 0x7F
+
+//
+// A transition program is an ordered list of register writes and settle
+// delays taking the chip from one state to another, see
+// FSA4480_BuildTransitionProgram. A SETTLE step waits DelayUs. READ steps
+// only appear in the batches handed to FSA4480_BUS Execute, they receive
+// Count bytes in Values.
+// Transition steps write at most two registers, the recovery program
+// writes a whole profile in one step.
+//
+typedef enum _FSA4480_STEP_TYPE
+{
+	FSA4480_STEP_WRITE,
+	FSA4480_STEP_SETTLE,
+	FSA4480_STEP_READ
+} FSA4480_STEP_TYPE;
+
+typedef struct _FSA4480_STEP
+{
+	BYTE Type;
 	BYTE Address;
-	BYTE Value;
-} FSA4480_DEFAULT_REGISTER_SETTING, *PFSA4480_DEFAULT_REGISTER_SETTING;
-
-static FSA4480_DEFAULT_REGISTER_SETTING gDefaultRegisterSettings[] =
-	{
-		{FSA4480_SLOW_L, 0x00},
-		{FSA4480_SLOW_R, 0x00},
-		{FSA4480_SLOW_MIC, 0x00},
-		{FSA4480_SLOW_SENSE, 0x00},
-		{FSA4480_SLOW_GND, 0x00},
-		{FSA4480_DELAY_L_R, 0x00},
-		{FSA4480_DELAY_L_MIC, 0x00},
-		{FSA4480_DELAY_L_SENSE, 0x00},
-		{FSA4480_DELAY_L_AGND, 0x09},
-		{FSA4480_SWITCH_SETTINGS, 0x98},
-};
+	BYTE Count;
+	BYTE Values[FSA4480_PROFILE_REGISTER_COUNT];
+	ULONG DelayUs;
+} FSA4480_STEP, *PFSA4480_STEP;
+
+#define FSA4480_MAX_TRANSITION_STEPS 3
+
+//
+// Soft reset, its settle delay and the profile ahead of a transition
+// program from FSA4480_STATE_UNKNOWN, see FSA4480_Recover
+//
+#define FSA4480_MAX_RECOVERY_STEPS (3 + FSA4480_MAX_TRANSITION_STEPS)
+
+//
+// The largest program, recovery, followed by the SWITCH_STATUS1 read
+// validating it
+//
+#define FSA4480_MAX_BATCH_STEPS (FSA4480_MAX_RECOVERY_STEPS + 1)
+
+typedef struct _FSA4480_TRANSITION_PROGRAM
+{
+	ULONG StepCount;
+	FSA4480_STEP Steps[FSA4480_MAX_TRANSITION_STEPS];
+} FSA4480_TRANSITION_PROGRAM, *PFSA4480_TRANSITION_PROGRAM;
+
+//
+// Hardware access used by the chip logic. Write and Read transfer Length
+// bytes starting at Address using the chip's address auto-increment,
+// Delay waits at least the given time and QueryTime returns a monotonic
+// timestamp in ticks of TimeFrequency per second.
+//
+// Execute is optional. It runs a batch of steps in order as a single bus
+// transaction, SETTLE steps wait SettleUs before the next step. When it
+// is set, every transition program goes out through it.
+//
+typedef NTSTATUS
+FSA4480_BUS_WRITE(
+	PVOID Context,
+	BYTE Address,
+	BYTE *Data,
+	ULONG Length);
+
+typedef NTSTATUS
+FSA4480_BUS_READ(
+	PVOID Context,
+	BYTE Address,
+	BYTE *Data,
+	ULONG Length);
+
+typedef NTSTATUS
+FSA4480_BUS_DELAY(
+	PVOID Context,
+	ULONG Microseconds);
+
+typedef LONGLONG
+FSA4480_BUS_QUERY_TIME(
+	PVOID Context);
+
+typedef NTSTATUS
+FSA4480_BUS_EXECUTE(
+	PVOID Context,
+	PFSA4480_STEP Steps,
+	ULONG StepCount);
+
+typedef struct _FSA4480_BUS
+{
+	PVOID Context;
+	FSA4480_BUS_WRITE *Write;
+	FSA4480_BUS_READ *Read;
+	FSA4480_BUS_DELAY *Delay;
+	FSA4480_BUS_QUERY_TIME *QueryTime;
+	FSA4480_BUS_EXECUTE *Execute;
+	LONGLONG TimeFrequency;
+} FSA4480_BUS, *PFSA4480_BUS;
+
+//
+// FSA4480_STATE_SNAPSHOT publication. The single writer, the thread
+// running the transitions, fills the slot Sequence does not select and
+// then increments Sequence. A reader copies the slot Sequence selects and
+// retries if Sequence moved meanwhile, it never waits for the writer and
+// never sees a slot being written, so any thread at any IRQL can read.
+//
+typedef struct _FSA4480_PUBLISHED_STATE
+{
+	volatile LONG Sequence;
+	FSA4480_STATE_SNAPSHOT Slots[2];
+} FSA4480_PUBLISHED_STATE, *PFSA4480_PUBLISHED_STATE;
+
+//
+// In place recovery from a failed transition, see FSA4480_Recover. At
+// most one recovery runs per FSA4480_RECOVERY_INTERVAL_MS, failures in
+// between are returned as they are and counted in Suppressed. LastTime
+// is 0 before the first recovery.
+//
+#define FSA4480_RECOVERY_INTERVAL_MS 100
+
+typedef struct _FSA4480_RECOVERY
+{
+	LONGLONG LastTime;
+	ULONG Attempts;
+	ULONG Succeeded;
+	ULONG Suppressed;
+} FSA4480_RECOVERY, *PFSA4480_RECOVERY;
+
+//
+// State of one FSA4480
+//
+typedef struct _FSA4480_CHIP
+{
+	FSA4480_BUS Bus;
+
+	USBC_PARTNER USBCPartner;
+
+	//
+	// FSA4480_ORIENTATION_xxx the mux was last switched for
+	//
+	ULONG Orientation;
+
+	//
+	// Current switch state and the programs for every transition out of it
+	//
+	FSA4480_STATE State;
+	FSA4480_TRANSITION_PROGRAM Transitions[FSA4480_STATE_COUNT + 1][FSA4480_STATE_COUNT];
+
+	//
+	// Switch timing profiles, filled in by the caller before
+	// FSA4480_Initialize, see FSA4480_InitializeProfiles. ActiveProfile is
+	// FSA4480_PROFILE_COUNT while the chip holds none of them.
+	//
+	FSA4480_PROFILE_TABLE ProfileTable;
+	FSA4480_PROFILE ActiveProfile;
+
+	//
+	// Shadow of the FSA4480 registers, used to filter redundant bus writes
+	//
+	FSA4480_REGISTER_CACHE RegisterCache;
+
+	//
+	// Settle delay used between programming and enabling the switches
+	//
+	FSA4480_SETTLE_DELAY SettleDelay;
+
+	//
+	// End-to-end switch latency of the switch in progress and histograms of
+	// all completed ones
+	//
+	FSA4480_SWITCH_TIMING SwitchTiming;
+	FSA4480_SWITCH_LATENCY SwitchLatency;
+
+	//
+	// Soft resets after failed transitions
+	//
+	FSA4480_RECOVERY Recovery;
+
+	//
+	// Lock-free copy of the state above, see FSA4480_ReadState
+	//
+	FSA4480_PUBLISHED_STATE PublishedState;
+} FSA4480_CHIP, *PFSA4480_CHIP;
 
 typedef enum _FSA4480_SWITCH_MODE
 {
@@ -92,20 +387,82 @@ typedef enum _FSA4480_SWITCH_MODE
 	FSA4480_SET_DP_DISCONNECTED
 } FSA4480_SWITCH_MODE;
 
+VOID
+FSA4480_InitializeProfiles(
+	PFSA4480_PROFILE_TABLE ProfileTable);
+
 NTSTATUS
 FSA4480_Switch(
-	WDFDEVICE Device,
+	PFSA4480_CHIP Chip,
 	FSA4480_SWITCH_MODE SwitchMode);
 
 NTSTATUS
 FSA4480_Initialize(
-	WDFDEVICE Device);
+	PFSA4480_CHIP Chip,
+	FSA4480_SWITCH_MODE SwitchMode);
 
 NTSTATUS
 FSA4480_Uninitialize(
-	WDFDEVICE Device);
+	PFSA4480_CHIP Chip);
+
+//
+// FSA4480_PowerDown must be called before EN is released and
+// FSA4480_PowerUp after it is asserted again
+//
+VOID
+FSA4480_PowerDown(
+	PFSA4480_CHIP Chip);
+
+NTSTATUS
+FSA4480_PowerUp(
+	PFSA4480_CHIP Chip);
 
 NTSTATUS
 FSA4480_OnUSBCModeChanged(
-	WDFDEVICE Device,
-	USBC_PARTNER USBCPartner);
\ No newline at end of file
+	PFSA4480_CHIP Chip,
+	USBC_PARTNER USBCPartner);
+
+VOID
+FSA4480_BeginSwitchTiming(
+	PFSA4480_CHIP Chip,
+	FSA4480_LATENCY_SOURCE Source,
+	LONGLONG StartTime);
+
+VOID
+FSA4480_RecordLatency(
+	PFSA4480_LATENCY_HISTOGRAM Histogram,
+	ULONG Microseconds);
+
+VOID
+FSA4480_GetSwitchLatency(
+	PFSA4480_CHIP Chip,
+	PFSA4480_SWITCH_LATENCY SwitchLatency);
+
+VOID
+FSA4480_ReadState(
+	PFSA4480_CHIP Chip,
+	PFSA4480_STATE_SNAPSHOT Snapshot);
+
+//
+// A register dump is begun under the chip lock, which fills in the
+// expected image and tells whether the register file has to be read, and
+// completed with the result of that read. FSA4480_DumpRegisters does both
+// around a blocking FSA4480_BUS Read.
+//
+BOOLEAN
+FSA4480_BeginRegisterDump(
+	PFSA4480_CHIP Chip,
+	BOOLEAN Powered,
+	PFSA4480_REGISTER_DUMP Dump);
+
+NTSTATUS
+FSA4480_DumpRegisters(
+	PFSA4480_CHIP Chip,
+	BOOLEAN Powered,
+	PFSA4480_REGISTER_DUMP Dump);
+
+VOID
+FSA4480_CompleteRegisterDump(
+	PFSA4480_REGISTER_DUMP Dump,
+	NTSTATUS ReadStatus,
+	LONGLONG Timestamp);
\ No newline at end of file
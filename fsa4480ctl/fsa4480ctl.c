@@ -0,0 +1,784 @@
+/*++
+
+Module Name:
+
+	fsa4480ctl.c
+
+Abstract:
+
+	User mode diagnostics tool for the FSA4480 driver. Talks to the
+	driver through the IOCTLs declared in public.h.
+
+Environment:
+
+	User mode
+
+--*/
+
+#include <windows.h>
+#include <winioctl.h>
+#include <initguid.h>
+#include <cfgmgr32.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "public.h"
+
+static const char *gLatencyModeNames[FSA4480_LATENCY_MODE_COUNT] =
+	{
+		"CC1",
+		"CC2",
+		"DP disconnected",
+		"Audio accessory",
+		"MIC/GND swap",
+};
+
+static const char *gLatencySourceNames[FSA4480_LATENCY_SOURCE_COUNT] =
+	{
+		"ACPI",
+		"GPIO",
+};
+
+static const char *gStateNames[FSA4480_STATE_COUNT + 1] =
+	{
+		"USB safe",
+		"DisplayPort CC1",
+		"DisplayPort CC2",
+		"Audio accessory",
+		"Audio MIC/GND swapped",
+		"unknown",
+};
+
+static const char *gPartnerNames[] =
+	{
+		"none",
+		"UFP",
+		"DFP",
+		"powered cable",
+		"powered cable with UFP",
+		"audio accessory",
+		"debug accessory",
+};
+
+static const char *gProfileNames[FSA4480_PROFILE_COUNT + 1] =
+	{
+		"fast",
+		"balanced",
+		"quiet",
+		"none",
+};
+
+static const char *gLatencyStageNames[FSA4480_LATENCY_STAGE_COUNT] =
+	{
+		"programmed",
+		"settled",
+		"complete",
+};
+
+HANDLE
+OpenDevice(VOID)
+{
+	CONFIGRET cr;
+	ULONG length = 0;
+	PWSTR interfaceList = NULL;
+	HANDLE device = INVALID_HANDLE_VALUE;
+
+	cr = CM_Get_Device_Interface_List_SizeW(
+		&length,
+		(LPGUID)&GUID_DEVINTERFACE_fsa4480,
+		NULL,
+		CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+
+	if (cr != CR_SUCCESS || length <= 1)
+	{
+		fprintf(stderr, "No FSA4480 device found\n");
+		goto exit;
+	}
+
+	interfaceList = (PWSTR)calloc(length, sizeof(WCHAR));
+	if (interfaceList == NULL)
+	{
+		goto exit;
+	}
+
+	cr = CM_Get_Device_Interface_ListW(
+		(LPGUID)&GUID_DEVINTERFACE_fsa4480,
+		NULL,
+		interfaceList,
+		length,
+		CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+
+	if (cr != CR_SUCCESS)
+	{
+		fprintf(stderr, "CM_Get_Device_Interface_List failed: 0x%lx\n", cr);
+		goto exit;
+	}
+
+	device = CreateFileW(
+		interfaceList,
+		GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (device == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Failed to open %ls: %lu\n", interfaceList, GetLastError());
+	}
+
+exit:
+	free(interfaceList);
+	return device;
+}
+
+//
+// Returns the upper bound, in microseconds, of the bucket holding the given
+// percentile. Samples are only known to the bucket, the reported value is
+// capped at the exact maximum.
+//
+ULONG
+HistogramPercentile(
+	PFSA4480_LATENCY_HISTOGRAM Histogram,
+	ULONG Percentile)
+{
+	ULONGLONG target;
+	ULONGLONG seen = 0;
+	ULONG bucket;
+	ULONG upperBound;
+
+	if (Histogram->Count == 0)
+	{
+		return 0;
+	}
+
+	target = ((ULONGLONG)Histogram->Count * Percentile + 99) / 100;
+
+	for (bucket = 0; bucket < FSA4480_LATENCY_BUCKET_COUNT; bucket++)
+	{
+		seen += Histogram->Buckets[bucket];
+		if (seen >= target)
+		{
+			break;
+		}
+	}
+
+	if (bucket >= FSA4480_LATENCY_BUCKET_COUNT - 1)
+	{
+		return Histogram->MaxUs;
+	}
+
+	upperBound = 1UL << bucket;
+
+	return upperBound < Histogram->MaxUs ? upperBound : Histogram->MaxUs;
+}
+
+int
+PrintLatency(
+	HANDLE Device)
+{
+	FSA4480_SWITCH_LATENCY latency;
+	DWORD bytesReturned = 0;
+	ULONG mode, source, stage;
+
+	if (!DeviceIoControl(
+			Device,
+			IOCTL_FSA4480_GET_SWITCH_LATENCY,
+			NULL,
+			0,
+			&latency,
+			sizeof(latency),
+			&bytesReturned,
+			NULL) ||
+		bytesReturned != sizeof(latency))
+	{
+		fprintf(stderr, "IOCTL_FSA4480_GET_SWITCH_LATENCY failed: %lu\n", GetLastError());
+		return 1;
+	}
+
+	if (latency.Version != FSA4480_LATENCY_VERSION)
+	{
+		fprintf(stderr, "Unsupported latency version %lu\n", latency.Version);
+		return 1;
+	}
+
+	printf("%-16s %-11s %8s %10s %10s %10s\n", "Mode", "Stage", "Count", "p50(us)", "p99(us)", "max(us)");
+
+	for (mode = 0; mode < FSA4480_LATENCY_MODE_COUNT; mode++)
+	{
+		for (stage = 0; stage < FSA4480_LATENCY_STAGE_COUNT; stage++)
+		{
+			PFSA4480_LATENCY_HISTOGRAM histogram = &latency.Histograms[mode][stage];
+
+			printf("%-16s %-11s %8lu %10lu %10lu %10lu\n",
+				   gLatencyModeNames[mode],
+				   gLatencyStageNames[stage],
+				   histogram->Count,
+				   HistogramPercentile(histogram, 50),
+				   HistogramPercentile(histogram, 99),
+				   histogram->MaxUs);
+		}
+	}
+
+	printf("\n%-16s %-11s %8s %10s %10s %10s\n", "Source", "Stage", "Count", "p50(us)", "p99(us)", "max(us)");
+
+	for (source = 0; source < FSA4480_LATENCY_SOURCE_COUNT; source++)
+	{
+		for (stage = 0; stage < FSA4480_LATENCY_STAGE_COUNT; stage++)
+		{
+			PFSA4480_LATENCY_HISTOGRAM histogram = &latency.Sources[source][stage];
+
+			printf("%-16s %-11s %8lu %10lu %10lu %10lu\n",
+				   gLatencySourceNames[source],
+				   gLatencyStageNames[stage],
+				   histogram->Count,
+				   HistogramPercentile(histogram, 50),
+				   HistogramPercentile(histogram, 99),
+				   histogram->MaxUs);
+		}
+	}
+
+	printf("%-16s %-11s %8lu %10lu %10lu %10lu\n",
+		   "ACPI lag",
+		   "-",
+		   latency.AcpiLag.Count,
+		   HistogramPercentile(&latency.AcpiLag, 50),
+		   HistogramPercentile(&latency.AcpiLag, 99),
+		   latency.AcpiLag.MaxUs);
+
+	return 0;
+}
+
+int
+PrintPower(
+	HANDLE Device)
+{
+	FSA4480_POWER_STATISTICS power;
+	DWORD bytesReturned = 0;
+	ULONGLONG totalUs;
+
+	if (!DeviceIoControl(
+			Device,
+			IOCTL_FSA4480_GET_POWER_STATISTICS,
+			NULL,
+			0,
+			&power,
+			sizeof(power),
+			&bytesReturned,
+			NULL) ||
+		bytesReturned != sizeof(power))
+	{
+		fprintf(stderr, "IOCTL_FSA4480_GET_POWER_STATISTICS failed: %lu\n", GetLastError());
+		return 1;
+	}
+
+	if (power.Version != FSA4480_POWER_VERSION)
+	{
+		fprintf(stderr, "Unsupported power statistics version %lu\n", power.Version);
+		return 1;
+	}
+
+	totalUs = power.GatedTimeUs + power.PoweredTimeUs;
+
+	printf("State:       %s\n", power.Gated ? "gated" : "powered");
+	printf("Hysteresis:  %lu ms\n", power.HysteresisMs);
+	printf("Gate count:  %lu\n", power.GateCount);
+	printf("Gated time:  %llu ms (%.1f%%)\n",
+		   power.GatedTimeUs / 1000,
+		   totalUs != 0 ? power.GatedTimeUs * 100.0 / totalUs : 0.0);
+	printf("Powered:     %llu ms\n", power.PoweredTimeUs / 1000);
+
+	return 0;
+}
+
+int
+PrintStart(
+	HANDLE Device)
+{
+	FSA4480_START_STATISTICS start;
+	DWORD bytesReturned = 0;
+	static const char *ccOutNames[] = {"CC1", "CC2", "open"};
+
+	if (!DeviceIoControl(
+			Device,
+			IOCTL_FSA4480_GET_START_STATISTICS,
+			NULL,
+			0,
+			&start,
+			sizeof(start),
+			&bytesReturned,
+			NULL) ||
+		bytesReturned != sizeof(start))
+	{
+		fprintf(stderr, "IOCTL_FSA4480_GET_START_STATISTICS failed: %lu\n", GetLastError());
+		return 1;
+	}
+
+	if (start.Version != FSA4480_START_VERSION)
+	{
+		fprintf(stderr, "Unsupported start statistics version %lu\n", start.Version);
+		return 1;
+	}
+
+	printf("Initial CC_OUT:     %s\n",
+		   start.InitialCCOut < ARRAYSIZE(ccOutNames) ? ccOutNames[start.InitialCCOut] : "?");
+	printf("Start mode:         %s\n", start.Asynchronous ? "asynchronous" : "synchronous");
+	printf("Chip status:        0x%08lx\n", (ULONG)start.ChipStatus);
+	printf("PrepareHardware:    %llu us\n", start.PrepareHardwareUs);
+	printf("Start to switched:  %llu us\n", start.StartToSwitchedUs);
+	printf("I2C transactions:   %lu\n", start.Transactions);
+	printf("I2C bus time:       %llu us\n", start.BusTimeUs);
+
+	return 0;
+}
+
+int
+PrintBus(
+	HANDLE Device)
+{
+	FSA4480_BUS_STATISTICS bus;
+	DWORD bytesReturned = 0;
+
+	if (!DeviceIoControl(
+			Device,
+			IOCTL_FSA4480_GET_BUS_STATISTICS,
+			NULL,
+			0,
+			&bus,
+			sizeof(bus),
+			&bytesReturned,
+			NULL) ||
+		bytesReturned != sizeof(bus))
+	{
+		fprintf(stderr, "IOCTL_FSA4480_GET_BUS_STATISTICS failed: %lu\n", GetLastError());
+		return 1;
+	}
+
+	if (bus.Version != FSA4480_BUS_VERSION)
+	{
+		fprintf(stderr, "Unsupported bus statistics version %lu\n", bus.Version);
+		return 1;
+	}
+
+	printf("Transactions:       %lu\n", bus.Transactions);
+	printf("Bytes written:      %lu\n", bus.BytesWritten);
+	printf("Bytes read:         %lu\n", bus.BytesRead);
+	printf("Bus time:           %llu us\n", bus.BusTimeUs);
+	printf("Requests allocated: %lu (%lu without reuse)\n", bus.RequestsAllocated, bus.Transactions);
+	printf("Requests reused:    %lu\n", bus.RequestsReused);
+	printf("Bytes copied:       %lu (%.1f per transaction)\n",
+		   bus.BytesCopied,
+		   bus.Transactions != 0 ? (double)bus.BytesCopied / bus.Transactions : 0.0);
+	printf("Zero-copy bytes:    %lu\n", bus.ZeroCopyBytes);
+
+	return 0;
+}
+
+int
+PrintState(
+	HANDLE Device)
+{
+	FSA4480_STATE_SNAPSHOT state;
+	DWORD bytesReturned = 0;
+	ULONG address;
+	static const char *orientationNames[] = {"CC1", "CC2", "open"};
+
+	if (!DeviceIoControl(
+			Device,
+			IOCTL_FSA4480_GET_STATE,
+			NULL,
+			0,
+			&state,
+			sizeof(state),
+			&bytesReturned,
+			NULL) ||
+		bytesReturned != sizeof(state))
+	{
+		fprintf(stderr, "IOCTL_FSA4480_GET_STATE failed: %lu\n", GetLastError());
+		return 1;
+	}
+
+	if (state.Version != FSA4480_STATE_SNAPSHOT_VERSION)
+	{
+		fprintf(stderr, "Unsupported state snapshot version %lu\n", state.Version);
+		return 1;
+	}
+
+	if (state.Generation == 0)
+	{
+		printf("The chip has not been started\n");
+		return 0;
+	}
+
+	printf("Generation:         %lu\n", state.Generation);
+	printf("State:              %s\n",
+		   state.State <= FSA4480_STATE_COUNT ? gStateNames[state.State] : "?");
+	printf("Orientation:        %s\n",
+		   state.Orientation < ARRAYSIZE(orientationNames) ? orientationNames[state.Orientation] : "?");
+	printf("Partner:            %s\n",
+		   state.Partner < ARRAYSIZE(gPartnerNames) ? gPartnerNames[state.Partner] : "?");
+	printf("Profile:            %s\n",
+		   state.Profile <= FSA4480_PROFILE_COUNT ? gProfileNames[state.Profile] : "?");
+	printf("Recoveries:         %lu (%lu succeeded, %lu suppressed)\n",
+		   state.RecoveryAttempts,
+		   state.RecoverySucceeded,
+		   state.RecoverySuppressed);
+	printf("Registers:");
+
+	for (address = 0; address < FSA4480_STATE_SNAPSHOT_REGISTER_COUNT; address++)
+	{
+		if (address % 8 == 0)
+		{
+			printf("\n  %02lx:", address);
+		}
+
+		if (state.RegisterValidMask & (1UL << address))
+		{
+			printf(" %02x", state.Registers[address]);
+		}
+		else
+		{
+			printf(" --");
+		}
+	}
+
+	printf("\n");
+
+	return 0;
+}
+
+int
+PrintDump(
+	HANDLE Device)
+{
+	FSA4480_REGISTER_DUMP dump;
+	DWORD bytesReturned = 0;
+	ULONG address;
+	ULONG mismatches = 0;
+
+	if (!DeviceIoControl(
+			Device,
+			IOCTL_FSA4480_GET_REGISTER_DUMP,
+			NULL,
+			0,
+			&dump,
+			sizeof(dump),
+			&bytesReturned,
+			NULL) ||
+		bytesReturned != sizeof(dump))
+	{
+		fprintf(stderr, "IOCTL_FSA4480_GET_REGISTER_DUMP failed: %lu\n", GetLastError());
+		return 1;
+	}
+
+	if (dump.Version != FSA4480_REGISTER_DUMP_VERSION)
+	{
+		fprintf(stderr, "Unsupported register dump version %lu\n", dump.Version);
+		return 1;
+	}
+
+	printf("State:              %s\n",
+		   dump.State <= FSA4480_STATE_COUNT ? gStateNames[dump.State] : "?");
+
+	if (dump.Status < 0)
+	{
+		printf("Read status:        0x%08lx, expected image only\n", (ULONG)dump.Status);
+	}
+	else
+	{
+		printf("Read at:            %.6f s\n", (double)dump.Timestamp / dump.Frequency);
+		for (address = 0; address < FSA4480_REGISTER_DUMP_COUNT; address++)
+		{
+			mismatches += (dump.MismatchMask >> address) & 1;
+		}
+
+		printf("Mismatches:         %lu\n", mismatches);
+	}
+
+	//
+	// Chip value, expected value, '!' where they differ
+	//
+	printf("Reg  Chip  Expected\n");
+
+	for (address = 0; address < FSA4480_REGISTER_DUMP_COUNT; address++)
+	{
+		if (dump.Status >= 0)
+		{
+			printf(" %02lx    %02x", address, dump.Registers[address]);
+		}
+		else
+		{
+			printf(" %02lx    --", address);
+		}
+
+		if (dump.ExpectedValidMask & (1UL << address))
+		{
+			printf("        %02x %s\n",
+				   dump.Expected[address],
+				   dump.MismatchMask & (1UL << address) ? "!" : "");
+		}
+		else
+		{
+			printf("        --\n");
+		}
+	}
+
+	return 0;
+}
+
+int __cdecl
+CompareTraceRecords(
+	const void *Left,
+	const void *Right)
+{
+	ULONG left = ((const FSA4480_SPB_TRACE_RECORD *)Left)->Sequence;
+	ULONG right = ((const FSA4480_SPB_TRACE_RECORD *)Right)->Sequence;
+
+	return left < right ? -1 : left > right ? 1 : 0;
+}
+
+//
+// Prints the recorded transfers oldest first, times relative to the
+// oldest one
+//
+int
+PrintTraceTimeline(
+	PFSA4480_SPB_TRACE Trace)
+{
+	ULONG i;
+	ULONG j;
+	ULONG count = 0;
+	LONGLONG origin = 0;
+
+	if (Trace->Version != FSA4480_SPB_TRACE_VERSION ||
+		Trace->RecordCount != FSA4480_SPB_TRACE_RECORD_COUNT ||
+		Trace->Frequency <= 0)
+	{
+		fprintf(stderr, "Unsupported SPB trace version %lu\n", Trace->Version);
+		return 1;
+	}
+
+	//
+	// Drop empty slots and order the rest by sequence
+	//
+	for (i = 0; i < FSA4480_SPB_TRACE_RECORD_COUNT; i++)
+	{
+		if (Trace->Records[i].Sequence != 0)
+		{
+			Trace->Records[count++] = Trace->Records[i];
+		}
+	}
+
+	qsort(Trace->Records, count, sizeof(Trace->Records[0]), CompareTraceRecords);
+
+	if (count != 0)
+	{
+		origin = Trace->Records[0].Timestamp;
+	}
+
+	printf("%lu of %lu transfers recorded\n", count, Trace->NextSequence - 1);
+	printf("   Sequence      Time us  Duration us  Op      Reg  Len  Data         Status\n");
+
+	for (i = 0; i < count; i++)
+	{
+		PFSA4480_SPB_TRACE_RECORD record = &Trace->Records[i];
+		char data[3 * FSA4480_SPB_TRACE_DATA_BYTES + 1] = "";
+
+		for (j = 0; j < record->Length && j < FSA4480_SPB_TRACE_DATA_BYTES; j++)
+		{
+			sprintf_s(&data[3 * j], sizeof(data) - 3 * j, "%02x ", record->Data[j]);
+		}
+
+		printf("%11lu %12.1f %12.1f  %-5s %c%c %02x %4u  %-12s 0x%08lx\n",
+			   record->Sequence,
+			   (double)(record->Timestamp - origin) * 1000000 / Trace->Frequency,
+			   (double)record->DurationTicks * 1000000 / Trace->Frequency,
+			   record->Flags & FSA4480_SPB_TRACE_READ ? "read" : "write",
+			   record->Flags & FSA4480_SPB_TRACE_BATCH ? 'B' : ' ',
+			   record->Flags & FSA4480_SPB_TRACE_ASYNC ? 'A' : ' ',
+			   record->Register,
+			   record->Length,
+			   data,
+			   (ULONG)record->Status);
+	}
+
+	return 0;
+}
+
+int
+PrintTrace(
+	HANDLE Device,
+	const char *FileName)
+{
+	PFSA4480_SPB_TRACE trace;
+	DWORD bytesReturned = 0;
+	FILE *file = NULL;
+	int result = 1;
+
+	trace = (PFSA4480_SPB_TRACE)malloc(sizeof(FSA4480_SPB_TRACE));
+	if (trace == NULL)
+	{
+		goto exit;
+	}
+
+	if (!DeviceIoControl(
+			Device,
+			IOCTL_FSA4480_GET_SPB_TRACE,
+			NULL,
+			0,
+			trace,
+			sizeof(FSA4480_SPB_TRACE),
+			&bytesReturned,
+			NULL) ||
+		bytesReturned != sizeof(FSA4480_SPB_TRACE))
+	{
+		fprintf(stderr, "IOCTL_FSA4480_GET_SPB_TRACE failed: %lu\n", GetLastError());
+		goto exit;
+	}
+
+	//
+	// Keep the raw dump for offline decoding with the decode command
+	//
+	if (FileName != NULL)
+	{
+		if (fopen_s(&file, FileName, "wb") != 0 ||
+			fwrite(trace, sizeof(FSA4480_SPB_TRACE), 1, file) != 1)
+		{
+			fprintf(stderr, "Failed to write %s\n", FileName);
+			goto exit;
+		}
+	}
+
+	result = PrintTraceTimeline(trace);
+
+exit:
+	if (file != NULL)
+	{
+		fclose(file);
+	}
+
+	free(trace);
+	return result;
+}
+
+int
+DecodeTrace(
+	const char *FileName)
+{
+	PFSA4480_SPB_TRACE trace;
+	FILE *file = NULL;
+	int result = 1;
+
+	trace = (PFSA4480_SPB_TRACE)malloc(sizeof(FSA4480_SPB_TRACE));
+	if (trace == NULL)
+	{
+		goto exit;
+	}
+
+	if (fopen_s(&file, FileName, "rb") != 0 ||
+		fread(trace, sizeof(FSA4480_SPB_TRACE), 1, file) != 1)
+	{
+		fprintf(stderr, "Failed to read %s\n", FileName);
+		goto exit;
+	}
+
+	result = PrintTraceTimeline(trace);
+
+exit:
+	if (file != NULL)
+	{
+		fclose(file);
+	}
+
+	free(trace);
+	return result;
+}
+
+VOID
+Usage(VOID)
+{
+	fprintf(stderr,
+			"Usage: fsa4480ctl <command>\n"
+			"\n"
+			"Commands:\n"
+			"  latency    Print switch latency percentiles per mode and stage\n"
+			"  power      Print EN power gating statistics\n"
+			"  start      Print the initial orientation and start timing\n"
+			"  bus        Print I2C traffic and request allocation counters\n"
+			"  state      Print the current mux state and register image\n"
+			"  dump       Read the register file and diff it against the state\n"
+			"  trace [f]  Print the I2C flight recorder, saving the dump to f\n"
+			"  decode f   Print a flight recorder dump saved by trace\n");
+}
+
+int __cdecl main(
+	int argc,
+	char *argv[])
+{
+	HANDLE device;
+	int result = 1;
+
+	if (argc < 2)
+	{
+		Usage();
+		return 1;
+	}
+
+	//
+	// Offline, no device needed
+	//
+	if (_stricmp(argv[1], "decode") == 0)
+	{
+		if (argc < 3)
+		{
+			Usage();
+			return 1;
+		}
+
+		return DecodeTrace(argv[2]);
+	}
+
+	device = OpenDevice();
+	if (device == INVALID_HANDLE_VALUE)
+	{
+		return 1;
+	}
+
+	if (_stricmp(argv[1], "latency") == 0)
+	{
+		result = PrintLatency(device);
+	}
+	else if (_stricmp(argv[1], "power") == 0)
+	{
+		result = PrintPower(device);
+	}
+	else if (_stricmp(argv[1], "start") == 0)
+	{
+		result = PrintStart(device);
+	}
+	else if (_stricmp(argv[1], "bus") == 0)
+	{
+		result = PrintBus(device);
+	}
+	else if (_stricmp(argv[1], "state") == 0)
+	{
+		result = PrintState(device);
+	}
+	else if (_stricmp(argv[1], "dump") == 0)
+	{
+		result = PrintDump(device);
+	}
+	else if (_stricmp(argv[1], "trace") == 0)
+	{
+		result = PrintTrace(device, argc > 2 ? argv[2] : NULL);
+	}
+	else
+	{
+		Usage();
+	}
+
+	CloseHandle(device);
+	return result;
+}
\ No newline at end of file